@@ -0,0 +1,100 @@
+#include "BlockCompare.h"
+#include <Windows.h>
+#include <intrin.h>
+#include <immintrin.h>
+
+size_t BlockCompare::FindMismatch(const void* data, const void* expected, size_t length)
+{
+    static const Kernel kernel = SelectKernel();
+    return kernel(static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(expected), length);
+}
+
+// Only used to find the end of a mismatching range, which is rare. A single byte that
+// happens to be equal does not end the range, a run of equal bytes does.
+size_t BlockCompare::FindMatch(const void* data, const void* expected, size_t length)
+{
+    constexpr size_t run = 16;
+    const unsigned char* a = static_cast<const unsigned char*>(data);
+    const unsigned char* b = static_cast<const unsigned char*>(expected);
+
+    size_t equal = 0;
+    for (size_t i = 0; i < length; i++) {
+        equal = (a[i] == b[i]) ? equal + 1 : 0;
+        if (equal == run) {
+            return i + 1 - run;
+        }
+    }
+    // Equal bytes at the very end still end the range
+    return length - equal;
+}
+
+BlockCompare::Kernel BlockCompare::SelectKernel()
+{
+    // Also tells whether the system saves the AVX registers on context switches
+    if (IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE)) {
+        return FindMismatchAvx2;
+    }
+    if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE)) {
+        return FindMismatchSse2;
+    }
+    return FindMismatchScalar;
+}
+
+size_t BlockCompare::FindMismatchScalar(const unsigned char* data, const unsigned char* expected, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != expected[i]) {
+            return i;
+        }
+    }
+    return length;
+}
+
+size_t BlockCompare::FindMismatchSse2(const unsigned char* data, const unsigned char* expected, size_t length)
+{
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(expected + i));
+        unsigned int equal = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+        if (equal != 0xFFFF) {
+            unsigned long index;
+            _BitScanForward(&index, ~equal);
+            return i + index;
+        }
+    }
+
+    return i + FindMismatchScalar(data + i, expected + i, length - i);
+}
+
+size_t BlockCompare::FindMismatchAvx2(const unsigned char* data, const unsigned char* expected, size_t length)
+{
+    size_t i = 0;
+
+    // 128 bytes per round, the exact position is only searched once something differs
+    for (; i + 128 <= length; i += 128) {
+        const __m256i* a = reinterpret_cast<const __m256i*>(data + i);
+        const __m256i* b = reinterpret_cast<const __m256i*>(expected + i);
+        __m256i difference = _mm256_or_si256(
+            _mm256_or_si256(_mm256_xor_si256(_mm256_loadu_si256(a), _mm256_loadu_si256(b)),
+                _mm256_xor_si256(_mm256_loadu_si256(a + 1), _mm256_loadu_si256(b + 1))),
+            _mm256_or_si256(_mm256_xor_si256(_mm256_loadu_si256(a + 2), _mm256_loadu_si256(b + 2)),
+                _mm256_xor_si256(_mm256_loadu_si256(a + 3), _mm256_loadu_si256(b + 3))));
+        if (!_mm256_testz_si256(difference, difference)) {
+            break;
+        }
+    }
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(expected + i));
+        unsigned int equal = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+        if (equal != 0xFFFFFFFF) {
+            unsigned long index;
+            _BitScanForward(&index, ~equal);
+            return i + index;
+        }
+    }
+
+    return i + FindMismatchSse2(data + i, expected + i, length - i);
+}
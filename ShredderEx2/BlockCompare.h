@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+
+// Byte-wise comparison of two buffers with AVX2 where the CPU and the system support
+// it, SSE2 otherwise. Both run at memory speed.
+class BlockCompare {
+public:
+    // Index of the first byte that differs, length if the buffers are equal
+    static size_t FindMismatch(const void* data, const void* expected, size_t length);
+    // Index where the buffers are equal again for a run of bytes, length if they never are
+    static size_t FindMatch(const void* data, const void* expected, size_t length);
+
+private:
+    using Kernel = size_t(*)(const unsigned char* data, const unsigned char* expected, size_t length);
+
+    static size_t FindMismatchScalar(const unsigned char* data, const unsigned char* expected, size_t length);
+    static size_t FindMismatchSse2(const unsigned char* data, const unsigned char* expected, size_t length);
+    static size_t FindMismatchAvx2(const unsigned char* data, const unsigned char* expected, size_t length);
+    static Kernel SelectKernel();
+};
@@ -0,0 +1,93 @@
+#include "BufferPool.h"
+#include "Privilege.h"
+
+BufferPool::~BufferPool()
+{
+    Release();
+}
+
+void BufferPool::Release()
+{
+    for (const Slab& slab : slabs) {
+        VirtualFree(slab.memory, 0, MEM_RELEASE);
+    }
+    slabs.clear();
+    buffers.clear();
+    freeBuffers.clear();
+}
+
+void BufferPool::Configure(DWORD size, bool largePages)
+{
+    lock_guard<mutex> guard(lock);
+    Release();
+    bufferSize = size;
+    slabAllocations = 0;
+    borrowCount = 0;
+
+    largePageSize = 0;
+    if (largePages && Privilege::Enable(SE_LOCK_MEMORY_NAME)) {
+        largePageSize = GetLargePageMinimum();
+    }
+}
+
+// One allocation for count buffers. A large page slab is rounded up to whole large pages
+// and the rest is carved into buffers as well. Large pages are often fragmented after the
+// system ran for a while, then the slab takes normal pages.
+bool BufferPool::AllocateSlab(size_t count)
+{
+    size_t size = count * bufferSize;
+    void* memory = nullptr;
+    bool largePages = false;
+    if (largePageSize != 0) {
+        size_t largeSize = (size + largePageSize - 1) / largePageSize * largePageSize;
+        memory = VirtualAlloc(nullptr, largeSize, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (memory) {
+            size = largeSize;
+            largePages = true;
+        }
+    }
+
+    // Page aligned, which satisfies every sector size up to 4 KB and all common larger ones
+    if (!memory) {
+        memory = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    }
+    if (!memory) {
+        return false;
+    }
+
+    slabs.push_back({ memory, largePages });
+    slabAllocations++;
+    for (size_t offset = 0; offset + bufferSize <= size; offset += bufferSize) {
+        buffers.push_back({ static_cast<uint8_t*>(memory) + offset, 0 });
+        freeBuffers.push_back(&buffers.back());
+    }
+    return true;
+}
+
+bool BufferPool::Borrow(size_t count, vector<Buffer*>& borrowed)
+{
+    lock_guard<mutex> guard(lock);
+    if (freeBuffers.size() < count && !AllocateSlab(count - freeBuffers.size())) {
+        return false;
+    }
+
+    // The most recently returned ones first, they are the likeliest to be in the cache and
+    // to hold the content the last file was written with
+    borrowed.insert(borrowed.end(), freeBuffers.end() - count, freeBuffers.end());
+    freeBuffers.resize(freeBuffers.size() - count);
+    borrowCount++;
+    return true;
+}
+
+void BufferPool::Return(vector<Buffer*>& borrowed)
+{
+    lock_guard<mutex> guard(lock);
+    freeBuffers.insert(freeBuffers.end(), borrowed.begin(), borrowed.end());
+    borrowed.clear();
+}
+
+size_t BufferPool::GetBufferCount() const
+{
+    lock_guard<mutex> guard(lock);
+    return buffers.size();
+}
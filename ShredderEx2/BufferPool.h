@@ -0,0 +1,82 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+using namespace std;
+
+// Page aligned I/O buffers shared by all overwrite workers. A worker borrows the buffers
+// for one file and returns them afterwards, so once the first files are through nothing
+// is allocated any more, however short-lived the worker threads are.
+// A buffer remembers which constant content it holds, so a pattern that was filled once
+// is written from it by every worker that borrows it later.
+class BufferPool {
+public:
+    struct Buffer {
+        void* data;
+        // Which constant content the buffer holds, 0 = nothing reusable
+        uint64_t content;
+    };
+
+private:
+    struct Slab {
+        void* memory;
+        bool largePages;
+    };
+
+    DWORD bufferSize = 0;
+    // Large page size when large pages are wanted and allowed, 0 otherwise
+    size_t largePageSize = 0;
+
+    vector<Slab> slabs;
+    // Stable addresses, borrowers keep pointers into it
+    deque<Buffer> buffers;
+    vector<Buffer*> freeBuffers;
+    mutable mutex lock;
+
+    atomic<uint64_t> slabAllocations{ 0 };
+    atomic<uint64_t> borrowCount{ 0 };
+
+    bool AllocateSlab(size_t count);
+    void Release();
+
+public:
+    BufferPool() = default;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    ~BufferPool();
+
+    // Drops all buffers, call only while none are borrowed. Large pages need
+    // SeLockMemoryPrivilege, without it or when no large pages are free the pool falls
+    // back to normal pages.
+    void Configure(DWORD size, bool largePages);
+
+    // Thread-safe. Appends count buffers, allocating when there are not enough free ones.
+    // False if the memory ran out, nothing is borrowed then.
+    bool Borrow(size_t count, vector<Buffer*>& borrowed);
+    // Thread-safe. Gives back all buffers in borrowed and clears it.
+    void Return(vector<Buffer*>& borrowed);
+
+    DWORD GetBufferSize() const {
+        return bufferSize;
+    }
+
+    // Slabs allocated since Configure. It stops growing once the pool covers the
+    // workers, a count that keeps rising means buffers are not returned.
+    uint64_t GetAllocationCount() const {
+        return slabAllocations;
+    }
+
+    uint64_t GetBorrowCount() const {
+        return borrowCount;
+    }
+
+    size_t GetBufferCount() const;
+
+    bool UsesLargePages() const {
+        return largePageSize != 0;
+    }
+};
@@ -0,0 +1,149 @@
+#include "ChaCha20.h"
+#include <Windows.h>
+#include <bcrypt.h>
+#include <cstring>
+#include <emmintrin.h>
+
+#pragma comment(lib, "bcrypt.lib")
+
+// "expand 32-byte k"
+static constexpr uint32_t sigma[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+
+static inline uint32_t RotateLeft(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static inline void QuarterRound(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    a += b; d = RotateLeft(d ^ a, 16);
+    c += d; b = RotateLeft(b ^ c, 12);
+    a += b; d = RotateLeft(d ^ a, 8);
+    c += d; b = RotateLeft(b ^ c, 7);
+}
+
+bool ChaCha20::CreateKey(uint32_t key[8])
+{
+    return BCRYPT_SUCCESS(BCryptGenRandom(nullptr, reinterpret_cast<PUCHAR>(key), 8 * sizeof(uint32_t), BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+}
+
+void ChaCha20::GenerateBlock(const uint32_t key[8], uint64_t nonce, uint64_t counter, uint8_t output[blockSize])
+{
+    uint32_t input[16] = {
+        sigma[0], sigma[1], sigma[2], sigma[3],
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32),
+        static_cast<uint32_t>(nonce), static_cast<uint32_t>(nonce >> 32)
+    };
+
+    uint32_t x[16];
+    memcpy(x, input, sizeof(x));
+    for (int round = 0; round < 10; round++) {
+        QuarterRound(x[0], x[4], x[8], x[12]);
+        QuarterRound(x[1], x[5], x[9], x[13]);
+        QuarterRound(x[2], x[6], x[10], x[14]);
+        QuarterRound(x[3], x[7], x[11], x[15]);
+        QuarterRound(x[0], x[5], x[10], x[15]);
+        QuarterRound(x[1], x[6], x[11], x[12]);
+        QuarterRound(x[2], x[7], x[8], x[13]);
+        QuarterRound(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        x[i] += input[i];
+    }
+    // x86 is little endian, which is the byte order of the keystream
+    memcpy(output, x, blockSize);
+}
+
+#define ROTATE_SSE2(v, bits) _mm_or_si128(_mm_slli_epi32(v, bits), _mm_srli_epi32(v, 32 - (bits)))
+
+#define QUARTER_ROUND_SSE2(a, b, c, d) \
+    a = _mm_add_epi32(a, b); d = ROTATE_SSE2(_mm_xor_si128(d, a), 16); \
+    c = _mm_add_epi32(c, d); b = ROTATE_SSE2(_mm_xor_si128(b, c), 12); \
+    a = _mm_add_epi32(a, b); d = ROTATE_SSE2(_mm_xor_si128(d, a), 8); \
+    c = _mm_add_epi32(c, d); b = ROTATE_SSE2(_mm_xor_si128(b, c), 7);
+
+// Every register holds the same state word of four consecutive blocks
+void ChaCha20::GenerateFourBlocks(const uint32_t key[8], uint64_t nonce, uint64_t counter, uint8_t output[blockSize * 4])
+{
+    __m128i input[16];
+    for (int i = 0; i < 4; i++) {
+        input[i] = _mm_set1_epi32(static_cast<int>(sigma[i]));
+    }
+    for (int i = 0; i < 8; i++) {
+        input[4 + i] = _mm_set1_epi32(static_cast<int>(key[i]));
+    }
+
+    uint32_t counterLow[4];
+    uint32_t counterHigh[4];
+    for (int i = 0; i < 4; i++) {
+        counterLow[i] = static_cast<uint32_t>(counter + i);
+        counterHigh[i] = static_cast<uint32_t>((counter + i) >> 32);
+    }
+    input[12] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(counterLow));
+    input[13] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(counterHigh));
+    input[14] = _mm_set1_epi32(static_cast<int>(nonce));
+    input[15] = _mm_set1_epi32(static_cast<int>(nonce >> 32));
+
+    __m128i x[16];
+    for (int i = 0; i < 16; i++) {
+        x[i] = input[i];
+    }
+
+    for (int round = 0; round < 10; round++) {
+        QUARTER_ROUND_SSE2(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND_SSE2(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND_SSE2(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND_SSE2(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND_SSE2(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND_SSE2(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND_SSE2(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND_SSE2(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        x[i] = _mm_add_epi32(x[i], input[i]);
+    }
+
+    // Transpose 4x4 groups of words, so every block ends up contiguous
+    for (int group = 0; group < 4; group++) {
+        __m128i a = x[group * 4 + 0];
+        __m128i b = x[group * 4 + 1];
+        __m128i c = x[group * 4 + 2];
+        __m128i d = x[group * 4 + 3];
+
+        __m128i ab0 = _mm_unpacklo_epi32(a, b);
+        __m128i ab1 = _mm_unpackhi_epi32(a, b);
+        __m128i cd0 = _mm_unpacklo_epi32(c, d);
+        __m128i cd1 = _mm_unpackhi_epi32(c, d);
+
+        __m128i* block = reinterpret_cast<__m128i*>(output) + group;
+        _mm_storeu_si128(block + 0, _mm_unpacklo_epi64(ab0, cd0));
+        _mm_storeu_si128(block + 4, _mm_unpackhi_epi64(ab0, cd0));
+        _mm_storeu_si128(block + 8, _mm_unpacklo_epi64(ab1, cd1));
+        _mm_storeu_si128(block + 12, _mm_unpackhi_epi64(ab1, cd1));
+    }
+}
+
+void ChaCha20::Generate(const uint32_t key[8], uint64_t nonce, uint64_t counter, void* output, size_t length)
+{
+    uint8_t* position = static_cast<uint8_t*>(output);
+
+    while (length >= blockSize * 4) {
+        GenerateFourBlocks(key, nonce, counter, position);
+        counter += 4;
+        position += blockSize * 4;
+        length -= blockSize * 4;
+    }
+
+    while (length > 0) {
+        uint8_t block[blockSize];
+        GenerateBlock(key, nonce, counter, block);
+        size_t used = length < blockSize ? length : blockSize;
+        memcpy(position, block, used);
+        counter++;
+        position += used;
+        length -= used;
+    }
+}
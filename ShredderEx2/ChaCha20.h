@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// ChaCha20 keystream (original variant, 64-bit nonce and 64-bit block counter).
+// The stream is seekable, block n of a stream covers bytes n * 64 to n * 64 + 63, so any
+// range can be regenerated later from the key, the nonce and the offset.
+// SSE2 computes four blocks at once, which is several GB/s per core.
+class ChaCha20 {
+public:
+    static constexpr size_t blockSize = 64;
+
+    // Fills a random key from the system generator
+    static bool CreateKey(uint32_t key[8]);
+
+    // Writes length bytes of the keystream, starting at block counter
+    static void Generate(const uint32_t key[8], uint64_t nonce, uint64_t counter, void* output, size_t length);
+
+private:
+    static void GenerateBlock(const uint32_t key[8], uint64_t nonce, uint64_t counter, uint8_t output[blockSize]);
+    static void GenerateFourBlocks(const uint32_t key[8], uint64_t nonce, uint64_t counter, uint8_t output[blockSize * 4]);
+};
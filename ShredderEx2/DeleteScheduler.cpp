@@ -0,0 +1,102 @@
+#include "DeleteScheduler.h"
+#include <chrono>
+#include <future>
+#include <vector>
+
+DeleteScheduler::DeleteScheduler(const ShredOptions& options, size_t capacity, atomic<bool>* cancellation)
+    : capacity(capacity > 0 ? capacity : 1),
+      largeFileSize(options.largeFileSize),
+      largeLanes(max(1u, options.largeFileLanes)),
+      smallWorkers(max(1u, options.deleteWorkers)),
+      cancellation(cancellation)
+{
+}
+
+size_t DeleteScheduler::AddDevice(const wstring& path)
+{
+    StorageDevice storage = StorageDevice::ForPath(path);
+
+    lock_guard<mutex> guard(lock);
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (devices[i].storage.diskNumber == storage.diskNumber) {
+            return i;
+        }
+    }
+
+    devices.emplace_back();
+    devices.back().storage = storage;
+    return devices.size() - 1;
+}
+
+bool DeleteScheduler::Push(PathTable::Handle node, uint64_t size, size_t device)
+{
+    unique_lock<mutex> guard(lock);
+    deque<PathTable::Handle>& queue = size >= largeFileSize ? devices[device].largeFiles : devices[device].smallFiles;
+    while (queue.size() >= capacity && !closed) {
+        if (IsCancelled()) {
+            return false;
+        }
+        // Poll, the cancellation flag does not notify us
+        notFull.wait_for(guard, chrono::milliseconds(50));
+    }
+
+    if (closed) {
+        return false;
+    }
+
+    queue.push_back(node);
+    notEmpty.notify_all();
+    return true;
+}
+
+// Returns false once there is nothing left for this worker, or on cancellation
+bool DeleteScheduler::Pop(Device& device, bool lane, PathTable::Handle& node)
+{
+    unique_lock<mutex> guard(lock);
+    for (;;) {
+        deque<PathTable::Handle>& own = lane ? device.largeFiles : device.smallFiles;
+        deque<PathTable::Handle>& other = lane ? device.smallFiles : device.largeFiles;
+        deque<PathTable::Handle>* queue = !own.empty() ? &own : (!other.empty() && (lane || closed)) ? &other : nullptr;
+        if (queue) {
+            node = queue->front();
+            queue->pop_front();
+            notFull.notify_all();
+            return true;
+        }
+
+        if ((closed && own.empty() && other.empty()) || IsCancelled()) {
+            return false;
+        }
+        notEmpty.wait_for(guard, chrono::milliseconds(50));
+    }
+}
+
+void DeleteScheduler::Close()
+{
+    lock_guard<mutex> guard(lock);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+}
+
+void DeleteScheduler::Run(const function<void(PathTable::Handle)>& process)
+{
+    vector<future<void>> workers;
+    for (Device& device : devices) {
+        unsigned int lanes = device.storage.seekPenalty ? 1 : largeLanes;
+        unsigned int pool = device.storage.seekPenalty ? 0 : smallWorkers;
+        for (unsigned int i = 0; i < lanes + pool; i++) {
+            bool lane = i < lanes;
+            workers.push_back(async(launch::async, [this, &device, lane, &process]() {
+                PathTable::Handle node;
+                while (Pop(device, lane, node)) {
+                    process(node);
+                }
+            }));
+        }
+    }
+
+    for (auto& worker : workers) {
+        worker.get();
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include "PathTable.h"
+#include "ShredOptions.h"
+#include "StorageDevice.h"
+
+using namespace std;
+
+// Hands files to the delete workers by physical disk and size. Every disk has its own
+// queues and workers, so disks are shredded side by side.
+// On a solid state disk a few lanes stream the large files, so one huge file does not
+// hold up thousands of small ones behind it, and a wide pool takes the small files, whose
+// time goes to per-file overhead rather than to the disk. A lane without large files takes
+// small ones. The pool only takes large files once no more small ones can come, so the
+// number of large streams stays bounded while both kinds are queued.
+// A spinning disk gets a single lane, parallel streams would only make it seek.
+class DeleteScheduler {
+private:
+    struct Device {
+        StorageDevice storage;
+        deque<PathTable::Handle> largeFiles;
+        deque<PathTable::Handle> smallFiles;
+    };
+
+    deque<Device> devices;
+    size_t capacity;
+    uint64_t largeFileSize;
+    unsigned int largeLanes;
+    unsigned int smallWorkers;
+    bool closed = false;
+    atomic<bool>* cancellation;
+    mutex lock;
+    condition_variable notFull;
+    condition_variable notEmpty;
+
+    bool IsCancelled() const {
+        return cancellation && *cancellation;
+    }
+
+    bool Pop(Device& device, bool lane, PathTable::Handle& node);
+
+public:
+    // capacity bounds each queue, SIZE_MAX when everything is known upfront
+    DeleteScheduler(const ShredOptions& options, size_t capacity, atomic<bool>* cancellation);
+
+    // Returns the device index for the files below path. Paths on the same disk share
+    // one index. All devices have to be added before Run.
+    size_t AddDevice(const wstring& path);
+
+    // Blocks while the queue for this device and size is full. Returns false once closed
+    // or cancelled.
+    bool Push(PathTable::Handle node, uint64_t size, size_t device);
+
+    // No more files will be pushed, the workers drain what is left
+    void Close();
+
+    // Runs the workers of all devices until the queues are closed and drained, or
+    // cancelled. process is called from all of them at once.
+    void Run(const function<void(PathTable::Handle)>& process);
+};
@@ -0,0 +1,449 @@
+#include "DirectoryEnumerator.h"
+#include <future>
+#include <thread>
+#include <cstring>
+
+DirectoryEnumerator::DirectoryEnumerator(const ShredOptions& options)
+    : workerCount(options.scanWorkers), backend(options.listing), linkPolicy(options.links)
+{
+    if (this->workerCount == 0) {
+        // Listing is mostly waiting on the file system, so use at least two workers
+        this->workerCount = max(2u, thread::hardware_concurrency());
+    }
+}
+
+void DirectoryEnumerator::Enumerate(PathTable& table, PathTable::Handle root, atomic<bool>* cancellation, function<void(PathTable::Handle)> onScan)
+{
+    this->table = &table;
+    this->cancellation = cancellation;
+    this->onScan = move(onScan);
+    this->onEntry = nullptr;
+    Run(root);
+    EmitChildrenFirst(0);
+}
+
+void DirectoryEnumerator::Stream(PathTable& table, PathTable::Handle root, atomic<bool>* cancellation, function<void(PathTable::Handle, bool isDirectory)> onEntry, function<void(PathTable::Handle)> onScan)
+{
+    this->table = &table;
+    this->cancellation = cancellation;
+    this->onScan = move(onScan);
+    this->onEntry = move(onEntry);
+    Run(root);
+}
+
+void DirectoryEnumerator::Run(PathTable::Handle root)
+{
+    nodes.clear();
+    workers.clear();
+    deferredLinks.clear();
+    visited.Clear();
+
+    for (unsigned int i = 0; i < workerCount; i++) {
+        workers.emplace_back();
+    }
+
+    size_t rootNode = AddNode(root, SIZE_MAX);
+    pendingDirectories = 1;
+    Push(0, rootNode);
+
+    // Every round lists everything reachable without the links found so far,
+    // the next round starts at those links
+    while (true) {
+        RunWorkers();
+
+        vector<size_t> links;
+        {
+            lock_guard<mutex> lock(deferredLinksMutex);
+            links.swap(deferredLinks);
+        }
+        if (links.empty() || IsCancelled()) {
+            break;
+        }
+
+        pendingDirectories = links.size();
+        for (size_t i = 0; i < links.size(); i++) {
+            Push(i % workers.size(), links[i]);
+        }
+    }
+}
+
+void DirectoryEnumerator::RunWorkers()
+{
+    vector<future<void>> activeWorkers;
+    for (size_t i = 0; i < workerCount; i++) {
+        activeWorkers.push_back(async(launch::async, [this, i]() {
+            RunWorker(i);
+        }));
+    }
+
+    for (auto& worker : activeWorkers) {
+        worker.get();
+    }
+}
+
+size_t DirectoryEnumerator::AddNode(PathTable::Handle handle, size_t parent)
+{
+    lock_guard<mutex> lock(nodesMutex);
+    DirectoryNode& node = nodes.emplace_back();
+    node.handle = handle;
+    node.parent = parent;
+    return nodes.size() - 1;
+}
+
+DirectoryEnumerator::DirectoryNode& DirectoryEnumerator::GetNode(size_t index)
+{
+    // deque never moves its elements, the lock only protects the lookup
+    lock_guard<mutex> lock(nodesMutex);
+    return nodes[index];
+}
+
+bool DirectoryEnumerator::QueryMetadata(const wstring& path, EntryMetadata& metadata)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data)) {
+        return false;
+    }
+
+    metadata.attributes = data.dwFileAttributes;
+    metadata.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+
+    HANDLE file = CreateFile(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        BY_HANDLE_FILE_INFORMATION info;
+        if (GetFileInformationByHandle(file, &info)) {
+            metadata.fileId = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+        }
+
+        FILE_ATTRIBUTE_TAG_INFO tagInfo;
+        if (GetFileInformationByHandleEx(file, FileAttributeTagInfo, &tagInfo, sizeof(tagInfo))) {
+            metadata.reparseTag = tagInfo.ReparseTag;
+        }
+        CloseHandle(file);
+    }
+
+    return true;
+}
+
+void DirectoryEnumerator::Push(size_t workerIndex, size_t node)
+{
+    Worker& worker = workers[workerIndex];
+    lock_guard<mutex> lock(worker.lock);
+    worker.tasks.push_back(node);
+}
+
+bool DirectoryEnumerator::PopLocal(size_t workerIndex, size_t& node)
+{
+    Worker& worker = workers[workerIndex];
+    lock_guard<mutex> lock(worker.lock);
+    if (worker.tasks.empty()) {
+        return false;
+    }
+
+    node = worker.tasks.back();
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool DirectoryEnumerator::Steal(size_t workerIndex, size_t& node)
+{
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker& victim = workers[(workerIndex + i) % workers.size()];
+        lock_guard<mutex> lock(victim.lock);
+        if (victim.tasks.empty()) {
+            continue;
+        }
+
+        // Take the oldest entry, it is the closest to the root and usually the largest subtree
+        node = victim.tasks.front();
+        victim.tasks.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+void DirectoryEnumerator::RunWorker(size_t workerIndex)
+{
+    int idleRounds = 0;
+    while (pendingDirectories > 0 && !IsCancelled()) {
+        size_t node;
+        if (PopLocal(workerIndex, node) || Steal(workerIndex, node)) {
+            idleRounds = 0;
+            ListDirectory(workerIndex, node);
+            pendingDirectories--;
+            continue;
+        }
+
+        // Other workers are still listing and may publish new directories soon
+        if (++idleRounds < 64) {
+            this_thread::yield();
+        }
+        else {
+            Sleep(1);
+        }
+    }
+}
+
+void DirectoryEnumerator::AddEntry(Worker& worker, wstring_view name, const EntryMetadata& metadata)
+{
+    if (name == L"." || name == L"..") {
+        return;
+    }
+
+    worker.entries.push_back({ worker.names.size(), name.size(), metadata });
+    worker.names.append(name);
+}
+
+static EntryMetadata ToMetadata(const FILE_ID_BOTH_DIR_INFO& info)
+{
+    EntryMetadata metadata;
+    metadata.size = info.EndOfFile.QuadPart;
+    metadata.fileId = info.FileId.QuadPart;
+    metadata.attributes = info.FileAttributes;
+    // For reparse points the listing reports the tag in place of the EA size
+    metadata.reparseTag = (info.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? info.EaSize : 0;
+    return metadata;
+}
+
+static EntryMetadata ToMetadata(const FILE_ID_EXTD_DIR_INFO& info)
+{
+    EntryMetadata metadata;
+    metadata.size = info.EndOfFile.QuadPart;
+    // 128-bit IDs of NTFS volumes are the 64-bit ID with the upper half zeroed
+    memcpy(&metadata.fileId, info.FileId.Identifier, sizeof(metadata.fileId));
+    metadata.attributes = info.FileAttributes;
+    metadata.reparseTag = info.ReparsePointTag;
+    return metadata;
+}
+
+// Walks the variable-length records one GetFileInformationByHandleEx call returned
+template<typename Info>
+void DirectoryEnumerator::AddEntries(Worker& worker)
+{
+    const BYTE* position = reinterpret_cast<const BYTE*>(worker.listBuffer.data());
+    while (true) {
+        const Info& info = *reinterpret_cast<const Info*>(position);
+        AddEntry(worker, wstring_view(info.FileName, info.FileNameLength / sizeof(wchar_t)), ToMetadata(info));
+
+        if (info.NextEntryOffset == 0) {
+            break;
+        }
+        position += info.NextEntryOffset;
+    }
+}
+
+// Records the directory behind the handle. Opening without FILE_FLAG_OPEN_REPARSE_POINT
+// resolves links, so a link and its target directory give the same key.
+bool DirectoryEnumerator::FirstVisit(HANDLE directory)
+{
+    FILE_ID_INFO idInfo;
+    if (!GetFileInformationByHandleEx(directory, FileIdInfo, &idInfo, sizeof(idInfo))) {
+        return true;
+    }
+
+    FileIdSet::Key key;
+    key.volume = idInfo.VolumeSerialNumber;
+    memcpy(&key.idLow, idInfo.FileId.Identifier, sizeof(key.idLow));
+    memcpy(&key.idHigh, idInfo.FileId.Identifier + sizeof(key.idLow), sizeof(key.idHigh));
+    return visited.Insert(key);
+}
+
+// Large fetches through a directory handle. One call fills the whole buffer, so a
+// directory with a million entries needs a few hundred calls instead of a million.
+void DirectoryEnumerator::ReadWithHandle(Worker& worker, HANDLE directory)
+{
+    if (worker.listBuffer.empty()) {
+        worker.listBuffer.resize(listBufferSize / sizeof(uint64_t));
+    }
+
+    DWORD bufferSize = static_cast<DWORD>(worker.listBuffer.size() * sizeof(uint64_t));
+    bool extended = backend == ListingBackend::FileIdExtd;
+    while (!IsCancelled()) {
+        if (extended) {
+            if (GetFileInformationByHandleEx(directory, FileIdExtdDirectoryInfo, worker.listBuffer.data(), bufferSize)) {
+                AddEntries<FILE_ID_EXTD_DIR_INFO>(worker);
+                continue;
+            }
+
+            // FAT volumes and systems before Windows 8 only know the 64-bit variant
+            DWORD error = GetLastError();
+            if (worker.entries.empty() && (error == ERROR_INVALID_PARAMETER || error == ERROR_NOT_SUPPORTED)) {
+                extended = false;
+                continue;
+            }
+            break;
+        }
+
+        if (!GetFileInformationByHandleEx(directory, FileIdBothDirectoryInfo, worker.listBuffer.data(), bufferSize)) {
+            break;
+        }
+        AddEntries<FILE_ID_BOTH_DIR_INFO>(worker);
+    }
+}
+
+// Skips the short names and asks for large batches. Does not return file IDs.
+void DirectoryEnumerator::ReadWithFindFirstFile(Worker& worker, const wstring& directoryPath)
+{
+    wstring pattern = directoryPath;
+    if (!pattern.ends_with(L'\\')) {
+        pattern += L'\\';
+    }
+    pattern += L'*';
+
+    WIN32_FIND_DATA findData;
+    HANDLE find = FindFirstFileEx(pattern.c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    do {
+        EntryMetadata metadata;
+        metadata.size = (static_cast<uint64_t>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow;
+        metadata.attributes = findData.dwFileAttributes;
+        metadata.reparseTag = (findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? findData.dwReserved0 : 0;
+        AddEntry(worker, findData.cFileName, metadata);
+    } while (!IsCancelled() && FindNextFile(find, &findData));
+
+    FindClose(find);
+}
+
+void DirectoryEnumerator::ListDirectory(size_t workerIndex, size_t index)
+{
+    DirectoryNode& node = GetNode(index);
+    Worker& worker = workers[workerIndex];
+    worker.names.clear();
+    worker.entries.clear();
+
+    wstring& directoryPath = worker.pathBuffer;
+    table->GetLongPath(node.handle, directoryPath);
+
+    // Collect the listing first, so all entries go into the table under one lock. Where
+    // links are followed, every directory is recorded, so a link back into the selection
+    // finds its target already scanned.
+    HANDLE directory = INVALID_HANDLE_VALUE;
+    bool recordVisits = linkPolicy != ReparsePolicy::DontFollow;
+    if (backend != ListingBackend::FindFirstFile || recordVisits) {
+        directory = CreateFile(directoryPath.c_str(), FILE_LIST_DIRECTORY | FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    }
+
+    bool firstVisit = !recordVisits || directory == INVALID_HANDLE_VALUE || FirstVisit(directory);
+    if (firstVisit) {
+        if (backend == ListingBackend::FindFirstFile) {
+            ReadWithFindFirstFile(worker, directoryPath);
+        }
+        else if (directory != INVALID_HANDLE_VALUE) {
+            ReadWithHandle(worker, directory);
+        }
+    }
+
+    if (directory != INVALID_HANDLE_VALUE) {
+        CloseHandle(directory);
+    }
+
+    worker.children.clear();
+    wstring_view names = worker.names;
+    for (const ListedEntry& entry : worker.entries) {
+        worker.children.push_back({ names.substr(entry.nameOffset, entry.nameLength), entry.metadata });
+    }
+
+    if (!worker.children.empty()) {
+        node.firstChild = table->AddChildren(node.handle, worker.children.data(), worker.children.size());
+        node.childCount = worker.children.size();
+    }
+
+    for (size_t i = 0; i < node.childCount; i++) {
+        PathTable::Handle child = node.firstChild + static_cast<PathTable::Handle>(i);
+        const EntryMetadata& metadata = worker.children[i].metadata;
+        if (metadata.IsDirectory()) {
+            size_t childNode = AddNode(child, index);
+            if (onEntry) {
+                node.remaining++;
+            }
+            else {
+                node.subDirs.push_back(childNode);
+            }
+
+            bool link = metadata.IsLink();
+            GetNode(childNode).behindLink = node.behindLink || link;
+            if (link && (linkPolicy == ReparsePolicy::DontFollow || (linkPolicy == ReparsePolicy::FollowOnce && node.behindLink))) {
+                // Stays an empty leaf, deleting it only removes the link
+                if (onEntry) {
+                    CompleteDirectory(childNode);
+                }
+            }
+            else if (link) {
+                lock_guard<mutex> lock(deferredLinksMutex);
+                deferredLinks.push_back(childNode);
+            }
+            else {
+                // Count before publishing, otherwise an idle worker could see zero and quit
+                pendingDirectories++;
+                Push(workerIndex, childNode);
+            }
+        }
+        else if (onEntry) {
+            onEntry(child, false);
+        }
+    }
+
+    if (onScan) {
+        onScan(node.childCount > 0 ? node.firstChild + static_cast<PathTable::Handle>(node.childCount - 1) : node.handle);
+    }
+
+    if (onEntry) {
+        CompleteDirectory(index);
+    }
+}
+
+// Drops the listing token of a directory. The last token of a subtree reports the
+// directory and passes the completion on to its parent.
+void DirectoryEnumerator::CompleteDirectory(size_t index)
+{
+    while (index != SIZE_MAX) {
+        DirectoryNode& node = GetNode(index);
+        if (--node.remaining > 0) {
+            return;
+        }
+
+        size_t parent = node.parent;
+        if (parent != SIZE_MAX) {
+            onEntry(node.handle, true);
+        }
+        index = parent;
+    }
+}
+
+// Rebuilds the order of the old recursive scan: the contents of the sub directories
+// (last one first), then the files of the directory and finally the sub directories themselves.
+void DirectoryEnumerator::EmitChildrenFirst(size_t root)
+{
+    vector<pair<size_t, size_t>> stack; // node, sub directories not yet emitted
+    stack.push_back({ root, nodes[root].subDirs.size() });
+
+    while (!stack.empty()) {
+        size_t index = stack.back().first;
+        size_t& remaining = stack.back().second;
+        DirectoryNode& node = nodes[index];
+
+        if (remaining > 0) {
+            remaining--;
+            size_t child = node.subDirs[remaining];
+            stack.push_back({ child, nodes[child].subDirs.size() });
+            continue;
+        }
+
+        for (size_t i = 0; i < node.childCount; i++) {
+            PathTable::Handle child = node.firstChild + static_cast<PathTable::Handle>(i);
+            if (!table->IsDirectory(child)) {
+                table->Emit(child);
+            }
+        }
+
+        for (size_t child : node.subDirs) {
+            table->Emit(nodes[child].handle);
+        }
+        stack.pop_back();
+    }
+}
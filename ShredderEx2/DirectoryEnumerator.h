@@ -0,0 +1,106 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include "PathTable.h"
+#include "ShredOptions.h"
+#include "FileIdSet.h"
+
+using namespace std;
+
+// Multi-threaded directory walker. Every worker owns a deque of directories,
+// works on it LIFO (depth-first, good locality) and steals FIFO from the
+// other workers when it runs dry.
+class DirectoryEnumerator {
+private:
+    struct DirectoryNode {
+        PathTable::Handle handle = PathTable::NoNode;
+        size_t parent = SIZE_MAX;
+        // All entries of a directory are added in one batch, so they are consecutive
+        PathTable::Handle firstChild = PathTable::NoNode;
+        size_t childCount = 0;
+        vector<size_t> subDirs;
+        // Listings still running in this subtree (streaming only)
+        atomic<size_t> remaining{ 1 };
+        // Reached through a junction or directory symbolic link
+        bool behindLink = false;
+    };
+
+    struct ListedEntry {
+        size_t nameOffset;
+        size_t nameLength;
+        EntryMetadata metadata;
+    };
+
+    struct Worker {
+        mutex lock;
+        deque<size_t> tasks;
+        // Only touched by the owning worker
+        wstring pathBuffer;
+        wstring names;
+        vector<ListedEntry> entries;
+        vector<PathTable::NewChild> children;
+        vector<uint64_t> listBuffer;
+    };
+
+    // Per worker, the handle based backends fill it in one call
+    static constexpr size_t listBufferSize = 1024 * 1024;
+
+    unsigned int workerCount;
+    ListingBackend backend;
+    ReparsePolicy linkPolicy;
+    PathTable* table = nullptr;
+    atomic<bool>* cancellation = nullptr;
+    function<void(PathTable::Handle)> onScan;
+    function<void(PathTable::Handle, bool)> onEntry;
+
+    deque<DirectoryNode> nodes;
+    mutex nodesMutex;
+    deque<Worker> workers;
+    atomic<size_t> pendingDirectories{ 0 };
+    // Links wait here until everything reachable without them has been listed
+    vector<size_t> deferredLinks;
+    mutex deferredLinksMutex;
+    FileIdSet visited;
+
+    size_t AddNode(PathTable::Handle handle, size_t parent);
+    DirectoryNode& GetNode(size_t index);
+    void Push(size_t workerIndex, size_t node);
+    bool PopLocal(size_t workerIndex, size_t& node);
+    bool Steal(size_t workerIndex, size_t& node);
+    void RunWorker(size_t workerIndex);
+    void ListDirectory(size_t workerIndex, size_t node);
+    bool FirstVisit(HANDLE directory);
+    void ReadWithHandle(Worker& worker, HANDLE directory);
+    void ReadWithFindFirstFile(Worker& worker, const wstring& directoryPath);
+    template<typename Info>
+    void AddEntries(Worker& worker);
+    static void AddEntry(Worker& worker, wstring_view name, const EntryMetadata& metadata);
+    void CompleteDirectory(size_t node);
+    void RunWorkers();
+    void Run(PathTable::Handle root);
+    void EmitChildrenFirst(size_t root);
+
+    bool IsCancelled() const {
+        return cancellation && *cancellation;
+    }
+
+public:
+    explicit DirectoryEnumerator(const ShredOptions& options);
+
+    // Metadata of a single path, for the roots that do not come from a listing
+    static bool QueryMetadata(const wstring& path, EntryMetadata& metadata);
+
+    // Adds everything below root to the table and emits it children before their parent
+    // directory. root itself is neither added nor emitted.
+    void Enumerate(PathTable& table, PathTable::Handle root, atomic<bool>* cancellation, function<void(PathTable::Handle)> onScan = nullptr);
+
+    // Same walk without emitting anything: files are handed to onEntry as soon as they
+    // are listed, directories once their whole subtree has been listed. onEntry is called
+    // from several workers at once. root itself is not reported.
+    void Stream(PathTable& table, PathTable::Handle root, atomic<bool>* cancellation, function<void(PathTable::Handle, bool isDirectory)> onEntry, function<void(PathTable::Handle)> onScan = nullptr);
+};
@@ -0,0 +1,97 @@
+#include "DurabilityBarrier.h"
+#include <string>
+#include <vector>
+
+DurabilityBarrier::~DurabilityBarrier()
+{
+    for (auto& volume : volumes) {
+        if (volume.second->handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(volume.second->handle);
+        }
+    }
+}
+
+// Flushes and adds the time it took to the totals
+bool DurabilityBarrier::Flush(HANDLE handle)
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    bool flushed = FlushFileBuffers(handle);
+    QueryPerformanceCounter(&end);
+
+    flushCount++;
+    flushMicroseconds += static_cast<uint64_t>((end.QuadPart - start.QuadPart) * 1'000'000 / frequency.QuadPart);
+    return flushed;
+}
+
+// The volume is opened the first time one of its files is committed. The GUID path of the
+// file starts with the name of its volume, "\\?\Volume{...}".
+DurabilityBarrier::Volume* DurabilityBarrier::GetVolume(HANDLE file)
+{
+    BY_HANDLE_FILE_INFORMATION fileInfo;
+    if (!GetFileInformationByHandle(file, &fileInfo)) {
+        return nullptr;
+    }
+
+    lock_guard<mutex> guard(volumesMutex);
+    unique_ptr<Volume>& volume = volumes[fileInfo.dwVolumeSerialNumber];
+    if (volume) {
+        return volume.get();
+    }
+
+    volume = make_unique<Volume>();
+    // A long path does not fit at first, the call then tells the size it needs
+    vector<wchar_t> path(MAX_PATH);
+    DWORD length = GetFinalPathNameByHandle(file, path.data(), static_cast<DWORD>(path.size()), VOLUME_NAME_GUID);
+    if (length >= path.size()) {
+        path.resize(length);
+        length = GetFinalPathNameByHandle(file, path.data(), static_cast<DWORD>(path.size()), VOLUME_NAME_GUID);
+    }
+    const wchar_t* separator = length > 0 && length < path.size() ? wcschr(path.data() + 4, L'\\') : nullptr;
+    if (separator && wcsncmp(path.data(), L"\\\\?\\Volume{", 11) == 0) {
+        wstring volumeName(static_cast<const wchar_t*>(path.data()), separator);
+        volume->handle = CreateFile(volumeName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+        volume->usable = volume->handle != INVALID_HANDLE_VALUE;
+    }
+    return volume.get();
+}
+
+// A flush only covers the writes that finished before it started. Whoever arrives while
+// no flush runs starts one, whoever arrives during a flush waits for the next one, which
+// then covers everybody who queued up meanwhile.
+bool DurabilityBarrier::Commit(HANDLE file)
+{
+    commitCount++;
+    Volume* volume = GetVolume(file);
+    if (!volume) {
+        return Flush(file);
+    }
+
+    unique_lock<mutex> guard(volume->lock);
+    uint64_t needed = volume->started + 1;
+    while (volume->usable && volume->completed < needed) {
+        if (volume->flushing) {
+            volume->flushed.wait(guard);
+            continue;
+        }
+
+        volume->flushing = true;
+        volume->started++;
+        guard.unlock();
+        bool flushed = Flush(volume->handle);
+        guard.lock();
+
+        volume->usable = flushed;
+        volume->completed = volume->started;
+        volume->flushing = false;
+        volume->flushed.notify_all();
+    }
+
+    // Also when the flush that should have covered this file failed
+    bool covered = volume->usable;
+    guard.unlock();
+    return covered || Flush(file);
+}
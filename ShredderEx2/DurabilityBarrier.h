@@ -0,0 +1,66 @@
+#pragma once
+#include <Windows.h>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+using namespace std;
+
+// Makes the overwritten data of a file durable before it is deleted, with one flush for
+// many files. FlushFileBuffers on a volume handle writes back the whole volume and the disk
+// cache at once, so workers that finish a file while a flush is running wait together
+// for the next one instead of flushing one by one (group commit).
+// Opening the volume needs administrator rights. Without them, and on volumes without a
+// GUID name like network shares, every file flushes its own handle.
+class DurabilityBarrier {
+private:
+    struct Volume {
+        // Opened for writing, INVALID_HANDLE_VALUE if that is not allowed
+        HANDLE handle = INVALID_HANDLE_VALUE;
+        // Cleared when a flush of the volume failed, the files flush themselves then
+        bool usable = false;
+        mutex lock;
+        condition_variable flushed;
+        uint64_t started = 0;
+        uint64_t completed = 0;
+        bool flushing = false;
+    };
+
+    // By volume serial number
+    unordered_map<DWORD, unique_ptr<Volume>> volumes;
+    mutex volumesMutex;
+
+    atomic<uint64_t> commitCount{ 0 };
+    atomic<uint64_t> flushCount{ 0 };
+    atomic<uint64_t> flushMicroseconds{ 0 };
+
+    Volume* GetVolume(HANDLE file);
+    bool Flush(HANDLE handle);
+
+public:
+    DurabilityBarrier() = default;
+    DurabilityBarrier(const DurabilityBarrier&) = delete;
+    DurabilityBarrier& operator=(const DurabilityBarrier&) = delete;
+    ~DurabilityBarrier();
+
+    // Thread-safe. Returns once everything written through file before the call is on
+    // the disk. The handle needs write access.
+    bool Commit(HANDLE file);
+
+    // Files committed and flushes issued since the start. Their ratio is the batch size,
+    // the time spent flushing is the cost of the mode.
+    uint64_t GetCommitCount() const {
+        return commitCount;
+    }
+
+    uint64_t GetFlushCount() const {
+        return flushCount;
+    }
+
+    uint64_t GetFlushMicroseconds() const {
+        return flushMicroseconds;
+    }
+};
@@ -0,0 +1,70 @@
+#include "FileIdSet.h"
+
+FileIdSet::FileIdSet()
+{
+    slots.resize(1024);
+}
+
+uint64_t FileIdSet::Hash(const Key& key)
+{
+    // File IDs are mostly sequential, mix them so neighbours spread over the table
+    uint64_t hash = key.idLow ^ (key.idHigh * 0x9E3779B97F4A7C15ull) ^ (key.volume * 0xC2B2AE3D27D4EB4Full);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+bool FileIdSet::Insert(const Key& key)
+{
+    lock_guard<mutex> guard(lock);
+    if (!InsertLocked(key)) {
+        return false;
+    }
+
+    // Keep the load below 70 %, probe chains stay short
+    if (++count * 10 > slots.size() * 7) {
+        Grow();
+    }
+    return true;
+}
+
+bool FileIdSet::InsertLocked(const Key& key)
+{
+    size_t mask = slots.size() - 1;
+    for (size_t i = Hash(key) & mask;; i = (i + 1) & mask) {
+        Key& slot = slots[i];
+        if (IsFree(slot)) {
+            slot = key;
+            return true;
+        }
+
+        if (slot.volume == key.volume && slot.idLow == key.idLow && slot.idHigh == key.idHigh) {
+            return false;
+        }
+    }
+}
+
+void FileIdSet::Grow()
+{
+    vector<Key> old(slots.size() * 2);
+    old.swap(slots);
+    for (const Key& key : old) {
+        if (!IsFree(key)) {
+            InsertLocked(key);
+        }
+    }
+}
+
+void FileIdSet::Clear()
+{
+    lock_guard<mutex> guard(lock);
+    slots.assign(1024, Key());
+    count = 0;
+}
+
+size_t FileIdSet::Size()
+{
+    lock_guard<mutex> guard(lock);
+    return count;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+using namespace std;
+
+// Set of (volume serial, 128-bit file ID) pairs, used to visit every directory only once.
+// Open addressing over a flat array, 24 bytes per slot and no allocation per entry.
+// Thread-safe.
+class FileIdSet {
+public:
+    struct Key {
+        uint64_t volume = 0;
+        uint64_t idLow = 0;
+        uint64_t idHigh = 0;
+    };
+
+private:
+    vector<Key> slots;
+    size_t count = 0;
+    mutex lock;
+
+    static uint64_t Hash(const Key& key);
+    // File ID 0 never names a directory, so the all-zero key marks a free slot
+    static bool IsFree(const Key& key) {
+        return key.volume == 0 && key.idLow == 0 && key.idHigh == 0;
+    }
+
+    bool InsertLocked(const Key& key);
+    void Grow();
+
+public:
+    FileIdSet();
+
+    // Returns false if the key was already in the set
+    bool Insert(const Key& key);
+    void Clear();
+    size_t Size();
+};
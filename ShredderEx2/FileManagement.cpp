@@ -1,115 +1,91 @@
 #include "FileManagement.h"
-#include <fstream>
 #include <iostream>
+#include <unordered_map>
+#include <algorithm>
 #include "FileLockFinder.h"
+#include "DirectoryEnumerator.h"
+#include "FreeSpaceWiper.h"
+#include "NameScrubber.h"
+#include "ParentDirectory.h"
+
+void FileManagement::GetAllNeededPaths(PathTable::Handle root, atomic<bool>* cancellation) {
+    DirectoryEnumerator enumerator(options);
+    enumerator.Enumerate(paths, root, cancellation, [this](PathTable::Handle scanFile) {
+        SetLatestScanFile(scanFile);
+    });
+}
 
-vector<wstring> FileManagement::GetAllNeededPaths(const wstring& path, atomic<bool>* cancellation) {
-    WIN32_FIND_DATA findFileData;
-    wstring searchPath = path + (path.ends_with(L"\\") ? L"*" : L"\\*");
-    HANDLE hFind = FindFirstFile(searchPath.c_str(), &findFileData);
-    vector<wstring> files;
-    vector<wstring> dirs;
-    vector<wstring> connected;
-
-    if (hFind == INVALID_HANDLE_VALUE) {
-        return connected;  // Leeren Vektor zurckgeben
-    }
-    else {
-        do {
-            wstring fileName = findFileData.cFileName;
-            if (fileName == L"." || fileName == L"..") {
-                continue; // Aktuelles oder bergeordnetes Verzeichnis berspringen
-            }
-            wstring fullPath = path + L"\\" + fileName;
-            SetLatestScanFile(fullPath);
-            if (findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-                dirs.push_back(fullPath);
-                vector<wstring> subDirs = GetAllNeededPaths(fullPath, cancellation);
-                connected.insert(connected.begin(), subDirs.begin(), subDirs.end());
-            }
-            else {
-                files.push_back(fullPath);
-            }
-        } while (FindNextFile(hFind, &findFileData) != 0 && !(cancellation && *cancellation));
-        FindClose(hFind);
+// Adds a target given by the user. Returns NoNode if it does not exist.
+PathTable::Handle FileManagement::AddRoot(const wstring& path)
+{
+    EntryMetadata metadata;
+    if (!DirectoryEnumerator::QueryMetadata(path, metadata)) {
+        return PathTable::NoNode;
     }
 
-    connected.insert(connected.end(), files.begin(), files.end());
-    connected.insert(connected.end(), dirs.begin(), dirs.end());
-
-    return connected;
+    return paths.AddRoot(path, metadata);
 }
 
-// Needed to make the file unrecoverable
-void FileManagement::OverwriteFileWithZeros(const wstring& filePath) {
-    for (int retry = 0; retry < 3; retry++) {
-        try {
-            fstream file(filePath, ios::binary | ios::out | ios::in);
-
-            if (!file.is_open()) {
-                SetBreakpoint(true);
-                while (GetBreakpoint()) {
-                    if (GetAction() == FileAction::None) {
-                        Sleep(1'000);
-                        this_thread::yield();
-                        continue;
-                    }
-
-                    switch (GetAction()) {
-                    case FileAction::None:
-                        Sleep(1'000);
-                        this_thread::yield();
-                        continue;
-                    case FileAction::Skip:
-                        if (!GetRemember()) {
-                            SetAction(FileAction::None);
-                        }
-                        SetBreakpoint(false);
-                        break;
-                    case FileAction::Kill:
-                        if (!GetRemember()) {
-                            SetAction(FileAction::None);
-                        }
-                        KillProcessesOfFile(filePath);
-                        SetBreakpoint(false);
-                        break;
-                    }
-                }
-                file.open(filePath, ios::binary | ios::out | ios::in);
+// Needed to make the file unrecoverable. Small files are deleted through the same handle,
+// returns true when the file is gone afterwards. result is Locked when the file could not
+// be opened and no remembered Kill freed it.
+// For a followed link the target is shredded and deleted, the link is left to the caller.
+bool FileManagement::OverwriteFileWithZeros(const wstring& filePath, const EntryMetadata& metadata, OverwriteEngine::Result& result) {
+    bool link = metadata.IsLink();
+    // The metadata is the link's, the engine asks for the attributes of the target
+    DWORD attributes = link ? INVALID_FILE_ATTRIBUTES : metadata.attributes;
+    bool deleted = false;
+    // Scrubbing needs the file after the overwrite, it deletes it itself
+    result = metadata.size <= OverwriteEngine::smallFileSize && !options.scrubNames && !link
+        ? overwriteEngine.OverwriteAndDelete(filePath, attributes, deleted)
+        : overwriteEngine.Overwrite(filePath, attributes);
+
+    if (result == OverwriteEngine::Result::Locked && GetRememberedAction() == FileAction::Kill) {
+        KillProcessesOfFile(filePath);
+        result = overwriteEngine.Overwrite(filePath, attributes);
+    }
 
-                if (!file.is_open()) {
-                    return;
-                }
-            }
+    if (link) {
+        // Another link or the target's own entry finds it gone then, so it is shredded once
+        if (result == OverwriteEngine::Result::Done) {
+            DeleteLinkTarget(filePath);
+        }
+        return false;
+    }
+    return deleted || result == OverwriteEngine::Result::Gone;
+}
 
-            file.seekg(0, ios::end);
-            streampos fileSize = file.tellg();
-            file.seekg(0, ios::beg);
+// Opening without FILE_FLAG_OPEN_REPARSE_POINT resolves the link
+void FileManagement::DeleteLinkTarget(const wstring& linkPath)
+{
+    HANDLE target = CreateFile(linkPath.c_str(), DELETE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, 0, nullptr);
+    if (target == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    OverwriteEngine::MarkForDeletion(target);
+    CloseHandle(target);
+}
 
-            constexpr size_t bufferSize = 1024 * 1024; // 1 MB Buffer
-            vector<char>* buffer = new vector<char>(bufferSize, 0);
+// File links follow the policy of the directory links the scan enters. FollowOnce does
+// not follow a link that was reached through another one.
+bool FileManagement::FollowsLink(PathTable::Handle node) const
+{
+    if (options.links == ReparsePolicy::DontFollow) {
+        return false;
+    }
 
-            while (fileSize > 0) {
-                size_t currentBlockSize = static_cast<size_t>(min(fileSize, static_cast<streampos>(bufferSize)));
-                file.write(buffer->data(), currentBlockSize);
-                fileSize -= currentBlockSize;
+    if (options.links == ReparsePolicy::FollowOnce) {
+        for (PathTable::Handle parent = paths.GetParent(node); parent != PathTable::NoNode; parent = paths.GetParent(parent)) {
+            if (paths.GetMetadata(parent).IsLink()) {
+                return false;
             }
-            delete buffer;
-
-            file.close();
         }
-        catch (...) {
-        	Sleep(1'000);
-			this_thread::yield();
-			continue;
-        }
-        break;
-	}
+    }
+    return true;
 }
 
-bool FileManagement::RemoveWriteProtection(const wstring& filePath) {
-    DWORD attributes = GetFileAttributes(filePath.c_str());
-
+bool FileManagement::RemoveWriteProtection(const wstring& filePath, DWORD attributes) {
     if (attributes == INVALID_FILE_ATTRIBUTES) {
         return false;
     }
@@ -124,56 +100,95 @@ bool FileManagement::RemoveWriteProtection(const wstring& filePath) {
     return true;
 }
 
-void FileManagement::Delete(const wstring& path, bool allowFolder)
+// Works from the metadata recorded by the scan. The file system is only asked again when
+// an operation fails, to tell a vanished or read-only file apart from a locked one.
+// Returns false for a locked file that was left in place for a retry, it is not counted
+// yet. A remembered Skip or Kill is applied right away instead. overwritten is set once
+// the contents are shredded, a retry with it set only deletes the entry.
+bool FileManagement::Delete(PathTable::Handle node, bool allowFolder, bool* overwritten)
 {
+    const EntryMetadata& metadata = paths.GetMetadata(node);
+    if (metadata.IsDirectory() != allowFolder) {
+        return true;
+    }
+    operationLimiter.Acquire(1);
+
+    // Rebuilt into the same buffer for every file of this worker
+    thread_local wstring path;
+    paths.GetLongPath(node, path);
+
     for (int retry = 0; retry < 3; retry++) {
         try {
-            if (!FileExists(path) && !DirectoryExists(path)) {
-                return;
+            if (metadata.IsDirectory()) {
+                if (!options.scrubNames || !NameScrubber::ScrubAndDelete(path, true)) {
+                    DeleteEntry(path, true);
+                }
+                IncrementProgress();
+                break;
             }
 
-            if (IsFile(path)) {
-                RemoveWriteProtection(path);
-                OverwriteFileWithZeros(path);
-
-                if (DeleteFile(path.c_str()) == 0)
-                {
-                    SetBreakpoint(true);
-                    while (GetBreakpoint()) {
-                        if (GetAction() == FileAction::None) {
-                            Sleep(1'000);
-                            this_thread::yield();
-                            continue;
-                        }
-
-                        switch (GetAction()) {
-                        case FileAction::None:
-                            Sleep(1'000);
-                            this_thread::yield();
-                            continue;
-                        case FileAction::Skip:
-                            if (!GetRemember()) {
-                                SetAction(FileAction::None);
-                            }
-                            SetBreakpoint(false);
-                            break;
-                        case FileAction::Kill:
-                            if (!GetRemember()) {
-                                SetAction(FileAction::None);
-                            }
-                            KillProcessesOfFile(path);
-                            DeleteFile(path.c_str());
-                            SetBreakpoint(false);
-                            break;
-                        }
+            // Unless links are followed only a link itself is deleted. DeleteEntry and
+            // the scrubber open the link, the overwrite would open its target.
+            if ((!metadata.IsLink() || FollowsLink(node)) && !(overwritten && *overwritten)) {
+                RemoveWriteProtection(path, metadata.attributes);
+                OverwriteEngine::Result result;
+                if (OverwriteFileWithZeros(path, metadata, result)) {
+                    IncrementProgress();
+                    break;
+                }
+
+                // A file that was only partly overwritten stays where it is
+                if (GetDeleteFutureCancellation()) {
+                    break;
+                }
+
+                // Deleting it unshredded is no option, it waits or is skipped as a whole
+                if (result == OverwriteEngine::Result::Locked) {
+                    if (GetRememberedAction() != FileAction::Skip) {
+                        return false;
                     }
+                    IncrementProgress();
+                    break;
                 }
-                SetProgress(GetProgress() + 1);
+
+                // E.g. no random key, a write error, a full disk or data that read back
+                // different. The file stays, so the failure shows instead of an unshredded
+                // file being deleted.
+                if (result == OverwriteEngine::Result::Failed || result == OverwriteEngine::Result::Mismatch) {
+                    AddFailedFile(node);
+                    IncrementProgress();
+                    break;
+                }
+
+                if (overwritten) {
+                    *overwritten = true;
+                }
+            }
+
+            if (options.scrubNames && NameScrubber::ScrubAndDelete(path, false)) {
+                IncrementProgress();
+                break;
             }
-            else if (allowFolder) {
-                RemoveDirectory(path.c_str());
-                SetProgress(GetProgress() + 1);
+
+            if (!DeleteEntry(path, false))
+            {
+                // Already gone, or it only became read-only after the scan
+                DWORD attributes = GetFileAttributes(path.c_str());
+                bool deleted = attributes == INVALID_FILE_ATTRIBUTES
+                    || ((attributes & FILE_ATTRIBUTE_READONLY) && RemoveWriteProtection(path, attributes) && DeleteEntry(path, false));
+
+                if (!deleted) {
+                    FileAction remembered = GetRememberedAction();
+                    if (remembered == FileAction::None) {
+                        return false;
+                    }
+                    if (remembered == FileAction::Kill) {
+                        KillProcessesOfFile(path);
+                        DeleteEntry(path, false);
+                    }
+                }
             }
+            IncrementProgress();
         }
         catch (...) {
 			Sleep(1'000);
@@ -182,66 +197,291 @@ void FileManagement::Delete(const wstring& path, bool allowFolder)
 		}
         break;
     }
+    return true;
 }
 
-void FileManagement::Delete(const vector<wstring>& paths)
+void FileManagement::AddFailedFile(PathTable::Handle node)
 {
-    pathsToDelete = paths;
-    activeFutures.push_back(async(launch::async, [&]() {
-        for (const wstring& path : pathsToDelete) {
-            this_thread::yield();
-            Delete(path);
-            SetLatestDeleteFile(path);
+    // The path is kept, a streaming job retires the node once it is finished
+    wstring path = paths.GetPath(node);
+    lock_guard<mutex> lock(failedFilesMutex);
+    failedFiles.push_back(move(path));
+    failedCount = failedFiles.size();
+}
 
-            if (GetDeleteFutureCancellation()) {
-				return;
-			}
+vector<wstring> FileManagement::GetFailedFiles() const
+{
+    lock_guard<mutex> lock(failedFilesMutex);
+    return failedFiles;
+}
+
+// A directory that is not empty stays, like with RemoveDirectory
+bool FileManagement::DeleteEntry(const wstring& path, bool isDirectory)
+{
+    if (options.deleteBackend == DeleteBackend::Relative) {
+        // Where the relative open fails, e.g. for a parent that does not grant adding
+        // entries, the path may still work
+        bool opened = false;
+        bool deleted = ParentDirectory::DeleteChild(path, opened);
+        if (opened) {
+            return deleted;
         }
+    }
+    return isDirectory ? RemoveDirectory(path.c_str()) : DeleteFile(path.c_str());
+}
 
-        for (const wstring& path : pathsToDelete) {
-            this_thread::yield();
-            Delete(path, true);
-            SetLatestDeleteFile(path);
-            if (GetDeleteFutureCancellation()) {
-                return;
+void FileManagement::Delete()
+{
+    activeFutures.push_back(async(launch::async, [&]() {
+        // Everything is known upfront, so the queues need no bound
+        scheduler = make_unique<DeleteScheduler>(options, SIZE_MAX, &deleteFutureCancellation);
+        unordered_map<PathTable::Handle, size_t> rootDevices;
+        for (size_t i = 0; i < paths.Size(); i++) {
+            PathTable::Handle node = paths.At(i);
+            const EntryMetadata& metadata = paths.GetMetadata(node);
+            if (metadata.IsDirectory()) {
+                // The listing is complete, the files finish the directory. An empty one
+                // is removed right away.
+                Finish(node);
+                continue;
             }
+
+            // A file is on the disk of the root it was found under
+            PathTable::Handle root = node;
+            while (paths.GetParent(root) != PathTable::NoNode) {
+                root = paths.GetParent(root);
+            }
+
+            auto device = rootDevices.find(root);
+            if (device == rootDevices.end()) {
+                device = rootDevices.emplace(root, scheduler->AddDevice(paths.GetPath(root))).first;
+            }
+            scheduler->Push(node, metadata.size, device->second);
+        }
+        scheduler->Close();
+        RunScheduler();
+
+        if (GetDeleteFutureCancellation()) {
+            return;
         }
 
         SetDone(true);
     }));
 }
 
-bool FileManagement::IsFile(const wstring& path)
+// Files of all sizes on the lanes and the pool of the scheduler. Directories are removed
+// by whichever worker finishes their last entry. Locked files go to the retry queue, so
+// the workers never wait for them, and the job ends once that is empty as well.
+void FileManagement::RunScheduler()
 {
-    DWORD fileType = GetFileAttributes(path.c_str());
+    future<void> retries = async(launch::async, [this]() {
+        RunRetries();
+    });
+
+    scheduler->Run([this](PathTable::Handle node) {
+        bool overwritten = false;
+        bool resolved = Delete(node, false, &overwritten);
+        SetLatestDeleteFile(node);
+        if (resolved) {
+            Finish(node);
+        }
+        else {
+            lockedFiles.Push(node, overwritten);
+        }
+    });
 
-    if (fileType == INVALID_FILE_ATTRIBUTES || fileType & FILE_ATTRIBUTE_DIRECTORY) {
-        return false;
+    lockedFiles.Close();
+    retries.wait();
+}
+
+// Tries the locked files again as they become due, until they are all deleted, or
+// resolved by the choice of the user. The buttons can be used while the workers still
+// run, for the files collected so far, or at the end, when only these are left.
+void FileManagement::RunRetries()
+{
+    vector<LockedFileQueue::Entry> due;
+    while (lockedFiles.Wait(due, decisionPollInterval)) {
+        if (GetDeleteFutureCancellation()) {
+            return;
+        }
+
+        for (LockedFileQueue::Entry& entry : due) {
+            if (Delete(entry.node, false, &entry.overwritten)) {
+                lockedFiles.Resolve();
+                Finish(entry.node);
+            }
+            else {
+                lockedFiles.Retry(entry);
+            }
+        }
+
+        // Without Remember the choice only applies to the files that wait right now
+        FileAction chosen = GetAction();
+        if (chosen != FileAction::None) {
+            if (!GetRemember()) {
+                SetAction(FileAction::None);
+            }
+            ResolveLockedFiles(chosen);
+        }
     }
+}
 
-    return true;
+// Skips or kills the holders of all waiting files. A file that is still locked after
+// Kill is skipped as well.
+void FileManagement::ResolveLockedFiles(FileAction chosen)
+{
+    vector<LockedFileQueue::Entry> taken;
+    lockedFiles.TakeAll(taken);
+
+    thread_local wstring path;
+    for (LockedFileQueue::Entry& entry : taken) {
+        if (GetDeleteFutureCancellation()) {
+            return;
+        }
+
+        bool resolved = false;
+        if (chosen == FileAction::Kill) {
+            paths.GetLongPath(entry.node, path);
+            KillProcessesOfFile(path);
+            resolved = Delete(entry.node, false, &entry.overwritten);
+        }
+        if (!resolved) {
+            IncrementProgress();
+        }
+
+        lockedFiles.Resolve();
+        SetLatestDeleteFile(entry.node);
+        Finish(entry.node);
+    }
 }
 
-bool FileManagement::FileExists(const wstring& path)
+// Drops a pending reference of node. The last one finishes it, a directory is removed
+// then, and the parent drops a reference in turn. A directory that could not be removed
+// because something inside was skipped still finishes its parent, whose removal then
+// fails the same way. A finished node is not needed any more and goes back to the table.
+void FileManagement::Finish(PathTable::Handle node)
 {
-    DWORD fileType = GetFileAttributes(path.c_str());
+    while (node != PathTable::NoNode && paths.Release(node)) {
+        if (GetDeleteFutureCancellation()) {
+            return;
+        }
 
-    if (fileType == INVALID_FILE_ATTRIBUTES) {
-        return false;
+        if (paths.IsDirectory(node)) {
+            Delete(node, true);
+            SetLatestDeleteFile(node);
+        }
+
+        PathTable::Handle parent = paths.GetParent(node);
+        paths.Retire(node);
+        node = parent;
     }
+}
 
-    return true;
+// Scans and shreds at the same time. The scan feeds files into the bounded queues of the
+// scheduler. A directory is finished once its subtree is listed, it is removed as soon as
+// its last entry is deleted. Finished entries are retired from the path table, so its
+// memory follows the entries in flight: the queues, the locked files and the directories
+// still open. The enumerator keeps a small record per directory until the end of a root.
+void FileManagement::DeleteStreaming(const vector<wstring>& roots)
+{
+    paths.EnableReclaim();
+    scheduler = make_unique<DeleteScheduler>(options, options.streamQueueCapacity, &deleteFutureCancellation);
+    scanning = true;
+
+    // The workers are started per disk, so the disks have to be known before the scan
+    vector<size_t> rootDevices;
+    for (const wstring& rootPath : roots) {
+        rootDevices.push_back(scheduler->AddDevice(rootPath));
+    }
+
+    activeFutures.push_back(async(launch::async, [this, roots, rootDevices]() {
+        DirectoryEnumerator enumerator(options);
+        for (size_t i = 0; i < roots.size(); i++) {
+            scannedCount++;
+            PathTable::Handle root = AddRoot(roots[i]);
+            if (root == PathTable::NoNode) {
+                continue;
+            }
+
+            size_t device = rootDevices[i];
+            if (!paths.IsDirectory(root)) {
+                scheduler->Push(root, paths.GetMetadata(root).size, device);
+                continue;
+            }
+
+            enumerator.Stream(paths, root, &deleteFutureCancellation, [this, device](PathTable::Handle node, bool isDirectory) {
+                scannedCount++;
+                if (isDirectory) {
+                    Finish(node);
+                }
+                else {
+                    scheduler->Push(node, paths.GetMetadata(node).size, device);
+                }
+            }, [this](PathTable::Handle scanFile) {
+                SetLatestScanFile(scanFile);
+            });
+
+            Finish(root);
+        }
+
+        scheduler->Close();
+        SetLatestScanFile(PathTable::NoNode);
+        scanning = false;
+    }));
+
+    // The queues are only closed after the scan finished, so every directory is gone or
+    // given up once they are drained
+    activeFutures.push_back(async(launch::async, [this]() {
+        RunScheduler();
+
+        if (GetDeleteFutureCancellation()) {
+            return;
+        }
+
+        SetDone(true);
+    }));
+}
+
+// Fills the free space of every volume that holds one of the targets, each volume once.
+// Progress counts megabytes instead of files.
+void FileManagement::WipeFreeSpace(const vector<wstring>& targets)
+{
+    vector<wstring> volumes;
+    uint64_t total = 0;
+    for (const wstring& target : targets) {
+        wstring volume = FreeSpaceWiper::GetVolumeRoot(target);
+        if (!volume.empty() && find(volumes.begin(), volumes.end(), volume) == volumes.end()) {
+            volumes.push_back(volume);
+            total += FreeSpaceWiper::GetFreeSpace(volume);
+        }
+    }
+    wipeTotal = static_cast<size_t>(total >> 20);
+
+    activeFutures.push_back(async(launch::async, [this, volumes]() {
+        FreeSpaceWiper wiper(overwriteEngine, &deleteFutureCancellation);
+        for (const wstring& volume : volumes) {
+            wiper.Wipe(volume, [this](const wstring& path) {
+                SetLatestDeleteFile(paths.AddRoot(path, EntryMetadata()));
+            });
+
+            if (GetDeleteFutureCancellation()) {
+                return;
+            }
+        }
+
+        SetDone(true);
+    }));
 }
 
-bool FileManagement::DirectoryExists(const wstring& path)
+bool FileManagement::IsFile(const wstring& path)
 {
-	DWORD fileType = GetFileAttributes(path.c_str());
+    DWORD fileType = GetFileAttributes(path.c_str());
 
-	if (fileType == INVALID_FILE_ATTRIBUTES || !(fileType & FILE_ATTRIBUTE_DIRECTORY)) {
-		return false;
-	}
+    if (fileType == INVALID_FILE_ATTRIBUTES || fileType & FILE_ATTRIBUTE_DIRECTORY) {
+        return false;
+    }
 
-	return true;
+    return true;
 }
 
 void FileManagement::KillProcessesOfFile(const wstring& path)
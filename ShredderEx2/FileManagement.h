@@ -3,6 +3,13 @@
 #include <string>
 #include <vector>
 #include <future>
+#include <memory>
+#include "ShredOptions.h"
+#include "DeleteScheduler.h"
+#include "PathTable.h"
+#include "OverwriteEngine.h"
+#include "RateLimiter.h"
+#include "LockedFileQueue.h"
 
 using namespace std;
 
@@ -15,51 +22,81 @@ public:
     };
 
 private:
-    wstring latestScanFile;
-    wstring latestDeleteFile;
-    mutex mutexString;
+    // How soon a Skip or Kill is picked up while no locked file is due
+    static constexpr DWORD decisionPollInterval = 100;
+
+    // Only handles are published, the UI rebuilds the path when it draws
+    atomic<PathTable::Handle> latestScanFile{ PathTable::NoNode };
+    atomic<PathTable::Handle> latestDeleteFile{ PathTable::NoNode };
 
     atomic<int> progress{ 0 };
-    atomic<bool> breakpoint{ false };
     atomic<bool> remember{ false };
     atomic<FileAction> action{ FileAction::None };
     atomic<bool> done{ false };
     atomic<bool> deleteFutureCancellation{ false };
-
+    atomic<bool> scanning{ false };
+    atomic<size_t> scannedCount{ 0 };
+    atomic<size_t> wipeTotal{ 0 };
+    // Files left in place because their overwrite failed or did not verify
+    vector<wstring> failedFiles;
+    atomic<size_t> failedCount{ 0 };
+    mutable mutex failedFilesMutex;
+
+    ShredOptions options;
     vector<future<void>> activeFutures;
-    vector<wstring> pathsToDelete;
-
-	void OverwriteFileWithZeros(const wstring& filePath);
-	void Delete(const wstring& path, bool allowFolder = false);
+    PathTable paths;
+    OverwriteEngine overwriteEngine;
+    // Files and directories per second, the bytes are limited by the engine
+    RateLimiter operationLimiter;
+    unique_ptr<DeleteScheduler> scheduler;
+    LockedFileQueue lockedFiles;
+
+	bool OverwriteFileWithZeros(const wstring& filePath, const EntryMetadata& metadata, OverwriteEngine::Result& result);
+	bool Delete(PathTable::Handle node, bool allowFolder = false, bool* overwritten = nullptr);
+    bool DeleteEntry(const wstring& path, bool isDirectory);
+    void DeleteLinkTarget(const wstring& linkPath);
+    bool FollowsLink(PathTable::Handle node) const;
+    void AddFailedFile(PathTable::Handle node);
+    void RunScheduler();
+    void RunRetries();
+    void ResolveLockedFiles(FileAction chosen);
+    void Finish(PathTable::Handle node);
     void KillProcessesOfFile(const wstring& path);
     void KillProcess(DWORD pid);
-    bool FileExists(const wstring& path);
-    bool DirectoryExists(const wstring& path);
-    bool RemoveWriteProtection(const wstring& filePath);
+    bool RemoveWriteProtection(const wstring& filePath, DWORD attributes);
+
+    // The choice for all locked files, if the user asked to remember it
+    FileAction GetRememberedAction() const {
+        return remember ? action.load() : FileAction::None;
+    }
 
 public:
-	vector<wstring> GetAllNeededPaths(const wstring& path, atomic<bool>* cancellation);
-	void Delete(const vector<wstring>& paths);
+	PathTable::Handle AddRoot(const wstring& path);
+	void GetAllNeededPaths(PathTable::Handle root, atomic<bool>* cancellation);
+	void Delete();
+    void DeleteStreaming(const vector<wstring>& roots);
+    void WipeFreeSpace(const vector<wstring>& targets);
 	bool IsFile(const wstring& path);
+    vector<wstring> GetFailedFiles() const;
     
-    void SetLatestScanFile(const wstring& filePath) {
-        lock_guard<mutex> lock(mutexString);
-        latestScanFile = filePath;
+    PathTable& GetPaths() {
+        return paths;
+    }
+
+    void SetLatestScanFile(PathTable::Handle node) {
+        latestScanFile = node;
     }
 
-    wstring GetLatestScanFile() {
-        lock_guard<mutex> lock(mutexString);
-        return latestScanFile;
+    wstring GetLatestScanFile() const {
+        return paths.GetDisplayPath(latestScanFile);
     }
 
-    void SetLatestDeleteFile(const wstring& filePath) {
-        lock_guard<mutex> lock(mutexString);
-        latestDeleteFile = filePath;
+    void SetLatestDeleteFile(PathTable::Handle node) {
+        latestDeleteFile = node;
     }
 
-    wstring GetLatestDeleteFile() {
-        lock_guard<mutex> lock(mutexString);
-        return latestDeleteFile;
+    wstring GetLatestDeleteFile() const {
+        return paths.GetDisplayPath(latestDeleteFile);
     }
 
     void SetProgress(int value) {
@@ -67,15 +104,24 @@ public:
     }
 
     int GetProgress() const {
+        // The free space wipe counts the megabytes of one pass instead of files
+        if (options.wipeFreeSpace) {
+            return static_cast<int>(overwriteEngine.GetBytesWritten() / max(static_cast<size_t>(1), overwriteEngine.GetPassCount()) >> 20);
+        }
         return progress;
     }
 
-    void SetBreakpoint(bool value) {
-        breakpoint = value;
+    void IncrementProgress() {
+        progress++;
     }
 
-    bool GetBreakpoint() const {
-        return breakpoint;
+    size_t GetFailedCount() const {
+        return failedCount;
+    }
+
+    // Locked files that wait for a retry or for Skip or Kill
+    size_t GetLockedCount() const {
+        return lockedFiles.Size();
     }
 
     void SetRemember(bool value) {
@@ -109,5 +155,51 @@ public:
     bool GetDeleteFutureCancellation() const {
 		return deleteFutureCancellation;
 	}
+
+    void SetOptions(const ShredOptions& value) {
+        options = value;
+        overwriteEngine.Configure(options);
+        overwriteEngine.SetCancellation(&deleteFutureCancellation);
+        operationLimiter.SetRate(options.maxOpsPerSecond);
+        operationLimiter.SetCancellation(&deleteFutureCancellation);
+    }
+
+    // Both limits can be changed while a job runs, 0 = unlimited
+    void SetMaxRate(uint64_t bytesPerSecond) {
+        overwriteEngine.SetMaxRate(bytesPerSecond);
+    }
+
+    uint64_t GetMaxRate() const {
+        return overwriteEngine.GetMaxRate();
+    }
+
+    void SetMaxOps(uint64_t operationsPerSecond) {
+        operationLimiter.SetRate(operationsPerSecond);
+    }
+
+    uint64_t GetMaxOps() const {
+        return operationLimiter.GetRate();
+    }
+
+    const ShredOptions& GetOptions() const {
+        return options;
+    }
+
+    const OverwriteEngine& GetOverwriteEngine() const {
+        return overwriteEngine;
+    }
+
+    bool GetScanning() const {
+        return scanning;
+    }
+
+    size_t GetScannedCount() const {
+        return scannedCount;
+    }
+
+    // Free megabytes of the volumes to wipe, counted when the wipe starts
+    size_t GetWipeTotal() const {
+        return wipeTotal;
+    }
 };
 
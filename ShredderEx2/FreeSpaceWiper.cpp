@@ -0,0 +1,117 @@
+#include "FreeSpaceWiper.h"
+#include "Privilege.h"
+
+FreeSpaceWiper::FreeSpaceWiper(OverwriteEngine& engine, atomic<bool>* cancellation)
+    : engine(engine), cancellation(cancellation)
+{
+}
+
+wstring FreeSpaceWiper::GetVolumeRoot(const wstring& path)
+{
+    // A relative path can be shorter than its volume root, the full path never is
+    vector<wchar_t> volumeRoot(max(static_cast<DWORD>(MAX_PATH), GetFullPathName(path.c_str(), 0, nullptr, nullptr)) + 1);
+    if (!GetVolumePathName(path.c_str(), volumeRoot.data(), static_cast<DWORD>(volumeRoot.size()))) {
+        return wstring();
+    }
+    return volumeRoot.data();
+}
+
+uint64_t FreeSpaceWiper::GetFreeSpace(const wstring& volumeRoot)
+{
+    ULARGE_INTEGER available;
+    if (!GetDiskFreeSpaceEx(volumeRoot.c_str(), &available, nullptr, nullptr)) {
+        return 0;
+    }
+    return available.QuadPart;
+}
+
+// Reserves size bytes, halving it while the volume is too full. The valid data length is
+// moved to the end, so the overlapped writes of the engine do not make the file system
+// zero the gaps in front of them first. Without the privilege the engine writes from the
+// start, which works as well.
+HANDLE FreeSpaceWiper::CreateFillFile(const wstring& path, uint64_t clusterSize, uint64_t& size)
+{
+    HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return file;
+    }
+
+    while (size >= clusterSize) {
+        FILE_END_OF_FILE_INFO endOfFile;
+        endOfFile.EndOfFile.QuadPart = size;
+        if (SetFileInformationByHandle(file, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile))) {
+            SetFileValidData(file, size);
+            return file;
+        }
+
+        if (GetLastError() != ERROR_DISK_FULL) {
+            break;
+        }
+        size = size / 2 / clusterSize * clusterSize;
+    }
+
+    CloseHandle(file);
+    DeleteFile(path.c_str());
+    SetLastError(ERROR_DISK_FULL);
+    return INVALID_HANDLE_VALUE;
+}
+
+bool FreeSpaceWiper::Wipe(const wstring& volumeRoot, const function<void(const wstring&)>& onFile)
+{
+    DWORD sectorsPerCluster;
+    DWORD bytesPerSector;
+    DWORD freeClusters;
+    DWORD totalClusters;
+    if (!GetDiskFreeSpace(volumeRoot.c_str(), &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters)) {
+        return false;
+    }
+    uint64_t clusterSize = static_cast<uint64_t>(sectorsPerCluster) * bytesPerSector;
+
+    wstring directory = volumeRoot + L"ShredderEx2 free space";
+    if (!CreateDirectory(directory.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        return false;
+    }
+    SetFileAttributes(directory.c_str(), FILE_ATTRIBUTE_HIDDEN);
+
+    // SetFileValidData needs it
+    Privilege::Enable(SE_MANAGE_VOLUME_NAME);
+
+    // Until the volume is full. Every file is overwritten before the next one is created,
+    // so the free space the next one sees is what is really left.
+    // A volume whose free space does not shrink, e.g. a compressed one, is done as well.
+    vector<wstring> files;
+    bool completed = false;
+    uint64_t lastFree = UINT64_MAX;
+    while (!IsCancelled()) {
+        uint64_t free = GetFreeSpace(volumeRoot);
+        uint64_t size = min(fillFileSize, free / clusterSize * clusterSize);
+        if (size < clusterSize || free >= lastFree) {
+            completed = true;
+            break;
+        }
+        lastFree = free;
+
+        wstring path = directory + L"\\fill" + to_wstring(files.size()) + L".tmp";
+        HANDLE file = CreateFillFile(path, clusterSize, size);
+        if (file == INVALID_HANDLE_VALUE) {
+            completed = GetLastError() == ERROR_DISK_FULL;
+            break;
+        }
+        CloseHandle(file);
+
+        files.push_back(path);
+        onFile(path);
+        OverwriteEngine::Result result = engine.Overwrite(path, FILE_ATTRIBUTE_HIDDEN);
+        if (result != OverwriteEngine::Result::Done && result != OverwriteEngine::Result::Mismatch) {
+            break;
+        }
+    }
+
+    // The engine wrote through, deleting only gives the space back
+    for (const wstring& path : files) {
+        DeleteFile(path.c_str());
+    }
+    RemoveDirectory(directory.c_str());
+
+    return completed;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include "OverwriteEngine.h"
+
+using namespace std;
+
+// Overwrites the free space of a volume, where the contents of files deleted without
+// shredding are still readable. The volume is filled with hidden files that go through the
+// overwrite engine like any other file, so passes, verify, throttling and cancellation
+// are the same, and they are deleted at the end.
+class FreeSpaceWiper {
+private:
+    // Large enough for long sequential writes, small enough that the last files can
+    // still take the space a shrinking volume has left
+    static constexpr uint64_t fillFileSize = uint64_t(1) << 30;
+
+    OverwriteEngine& engine;
+    atomic<bool>* cancellation;
+
+    bool IsCancelled() const {
+        return cancellation && *cancellation;
+    }
+
+    HANDLE CreateFillFile(const wstring& path, uint64_t clusterSize, uint64_t& size);
+
+public:
+    FreeSpaceWiper(OverwriteEngine& engine, atomic<bool>* cancellation);
+
+    // Root of the volume of path, e.g. "D:\" or "C:\Mount\Data\". Empty if unknown.
+    static wstring GetVolumeRoot(const wstring& path);
+    static uint64_t GetFreeSpace(const wstring& volumeRoot);
+
+    // Fills and overwrites the free space of the volume. onFile is called with every fill
+    // file before it is written. Returns false if it was cancelled or could not start.
+    bool Wipe(const wstring& volumeRoot, const function<void(const wstring&)>& onFile);
+};
@@ -0,0 +1,68 @@
+#include "LockedFileQueue.h"
+#include <algorithm>
+#include <chrono>
+
+void LockedFileQueue::Schedule(Entry entry)
+{
+    entry.due = GetTickCount64() + min(firstDelay << min(entry.attempts, 16u), maxDelay);
+
+    lock_guard<mutex> guard(lock);
+    entries.push_back(entry);
+    changed.notify_all();
+}
+
+void LockedFileQueue::Push(PathTable::Handle node, bool overwritten)
+{
+    count++;
+    Schedule({ node, overwritten, 0, 0 });
+}
+
+void LockedFileQueue::Retry(const Entry& entry)
+{
+    Schedule({ entry.node, entry.overwritten, entry.attempts + 1, 0 });
+}
+
+void LockedFileQueue::Close()
+{
+    lock_guard<mutex> guard(lock);
+    closed = true;
+    changed.notify_all();
+}
+
+bool LockedFileQueue::Wait(vector<Entry>& due, DWORD maxWait)
+{
+    due.clear();
+    unique_lock<mutex> guard(lock);
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG deadline = now + maxWait;
+    for (;;) {
+        if (closed && entries.empty()) {
+            return false;
+        }
+
+        ULONGLONG next = deadline;
+        for (size_t i = 0; i < entries.size();) {
+            if (entries[i].due <= now) {
+                due.push_back(entries[i]);
+                entries[i] = entries.back();
+                entries.pop_back();
+                continue;
+            }
+            next = min(next, entries[i].due);
+            i++;
+        }
+        if (!due.empty() || now >= deadline) {
+            return true;
+        }
+
+        changed.wait_for(guard, chrono::milliseconds(next - now));
+        now = GetTickCount64();
+    }
+}
+
+void LockedFileQueue::TakeAll(vector<Entry>& taken)
+{
+    lock_guard<mutex> guard(lock);
+    taken.insert(taken.end(), entries.begin(), entries.end());
+    entries.clear();
+}
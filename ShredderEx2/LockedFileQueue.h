@@ -0,0 +1,65 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "PathTable.h"
+
+using namespace std;
+
+// Files that were locked when a delete worker got to them. They wait here while the
+// rest of the job goes on and are tried again in the background, with the delay doubling
+// after every failed attempt, until they can be deleted or the user decides for all of
+// them at once.
+// A file keeps the pending reference on its directory while it waits, so the directory
+// is only removed once the file is resolved. Thread-safe.
+class LockedFileQueue {
+public:
+    struct Entry {
+        PathTable::Handle node;
+        // Only the delete failed, a retry does not write the contents again
+        bool overwritten;
+        unsigned int attempts;
+        ULONGLONG due;
+    };
+
+private:
+    static constexpr ULONGLONG firstDelay = 250;
+    // A file that stays locked is still looked at twice a minute
+    static constexpr ULONGLONG maxDelay = 30'000;
+
+    vector<Entry> entries;
+    atomic<size_t> count{ 0 };
+    bool closed = false;
+    mutex lock;
+    condition_variable changed;
+
+    void Schedule(Entry entry);
+
+public:
+    void Push(PathTable::Handle node, bool overwritten);
+
+    // Puts back an entry whose attempt failed again, with what that attempt got done
+    void Retry(const Entry& entry);
+
+    // An entry that was taken is deleted or given up
+    void Resolve() {
+        count--;
+    }
+
+    // No more files will be pushed by the workers. Retries can still be put back.
+    void Close();
+
+    // Waits at most maxWait for entries that are due and moves them to due. Returns false
+    // once closed and empty.
+    bool Wait(vector<Entry>& due, DWORD maxWait);
+
+    // Removes all entries, due or not
+    void TakeAll(vector<Entry>& taken);
+
+    // Files that are not resolved yet, including the ones being tried right now
+    size_t Size() const {
+        return count;
+    }
+};
@@ -0,0 +1,98 @@
+#include "NameScrubber.h"
+#include <vector>
+#include <cstddef>
+#include "ChaCha20.h"
+#include "OverwriteEngine.h"
+#include "ParentDirectory.h"
+
+// Lower case letters and digits, the same in every code page and on every file system
+void NameScrubber::RandomName(wchar_t* name, size_t length)
+{
+    static constexpr wchar_t alphabet[] = L"abcdefghijklmnopqrstuvwxyz0123456789";
+    thread_local uint32_t key[8];
+    thread_local bool hasKey = false;
+    thread_local uint64_t counter = 0;
+    if (!hasKey) {
+        hasKey = ChaCha20::CreateKey(key);
+    }
+
+    uint8_t random[ChaCha20::blockSize];
+    for (size_t i = 0; i < length; i++) {
+        if (i % ChaCha20::blockSize == 0) {
+            ChaCha20::Generate(key, 0, counter++, random, sizeof(random));
+        }
+        name[i] = alphabet[random[i % ChaCha20::blockSize] % 36];
+    }
+}
+
+bool NameScrubber::Rename(HANDLE file, HANDLE directory, const wchar_t* name, size_t length)
+{
+    thread_local vector<uint64_t> buffer;
+    size_t size = offsetof(FILE_RENAME_INFO, FileName) + (length + 1) * sizeof(WCHAR);
+    buffer.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+
+    FILE_RENAME_INFO* rename = reinterpret_cast<FILE_RENAME_INFO*>(buffer.data());
+    rename->ReplaceIfExists = FALSE;
+    rename->RootDirectory = directory;
+    rename->FileNameLength = static_cast<DWORD>(length * sizeof(WCHAR));
+    wmemcpy(rename->FileName, name, length);
+    rename->FileName[length] = L'\0';
+    return SetFileInformationByHandle(file, FileRenameInfo, rename, static_cast<DWORD>(size));
+}
+
+bool NameScrubber::ScrubAndDelete(const wstring& path, bool isDirectory)
+{
+    wstring_view directoryPath;
+    wstring_view original;
+    if (!ParentDirectory::Split(path, directoryPath, original)) {
+        return false;
+    }
+
+    HANDLE directory = ParentDirectory::Open(directoryPath);
+    if (directory == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // A link is scrubbed itself, not its target
+    DWORD access = DELETE | FILE_WRITE_ATTRIBUTES | (isDirectory ? 0 : FILE_WRITE_DATA);
+    HANDLE entry = ParentDirectory::OpenChild(directory, original, access);
+    if (entry == INVALID_HANDLE_VALUE) {
+        ParentDirectory::Release();
+        return false;
+    }
+
+    if (!isDirectory) {
+        FILE_END_OF_FILE_INFO endOfFile;
+        endOfFile.EndOfFile.QuadPart = 0;
+        SetFileInformationByHandle(entry, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile));
+    }
+
+    FILE_BASIC_INFO basicInfo = {};
+    basicInfo.CreationTime.QuadPart = scrubTime;
+    basicInfo.LastAccessTime.QuadPart = scrubTime;
+    basicInfo.LastWriteTime.QuadPart = scrubTime;
+    basicInfo.ChangeTime.QuadPart = scrubTime;
+    SetFileInformationByHandle(entry, FileBasicInfo, &basicInfo, sizeof(basicInfo));
+
+    // A random name can collide with an existing one, then the round takes another
+    size_t length = original.size();
+    thread_local wstring name;
+    name.resize(length);
+    bool renamed = false;
+    for (int round = 0, attempt = 0; round < renameRounds && attempt < renameRounds * 4; attempt++) {
+        RandomName(&name[0], length);
+        if (Rename(entry, directory, name.c_str(), length)) {
+            renamed = true;
+            round++;
+        }
+    }
+
+    bool deleted = OverwriteEngine::MarkForDeletion(entry);
+    if (!deleted && renamed) {
+        Rename(entry, directory, original.data(), length);
+    }
+
+    CloseHandle(entry);
+    ParentDirectory::Release();
+    return deleted;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+// Removes what a directory entry tells after the contents are gone: the size, the
+// timestamps and the name. The entry is renamed a few times to random names of the same
+// length before it is deleted, so the directory index and the journal keep those instead
+// of the original name.
+// The renames are relative to the handle of the parent directory the thread keeps, see
+// ParentDirectory.
+class NameScrubber {
+private:
+    static constexpr int renameRounds = 3;
+    // 1980-01-01, the earliest time FAT volumes can store
+    static constexpr int64_t scrubTime = 119600064000000000;
+
+    static void RandomName(wchar_t* name, size_t length);
+    static bool Rename(HANDLE file, HANDLE directory, const wchar_t* name, size_t length);
+
+public:
+    // Truncates and scrubs a file or an empty directory and deletes it. On failure the
+    // entry keeps or gets back its original name, so the caller can fall back to
+    // DeleteFile or RemoveDirectory.
+    static bool ScrubAndDelete(const wstring& path, bool isDirectory);
+};
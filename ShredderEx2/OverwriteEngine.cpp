@@ -0,0 +1,769 @@
+#include "OverwriteEngine.h"
+#include <winternl.h>
+#include <cstring>
+#include "ChaCha20.h"
+#include "BlockCompare.h"
+#include <algorithm>
+
+#pragma comment(lib, "ntdll.lib")
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(status) (static_cast<NTSTATUS>(status) >= 0)
+#endif
+
+OverwriteEngine::OverwriteEngine()
+{
+    passes = OverwritePass::ForScheme(OverwriteScheme::Zeros);
+    hasKey = ChaCha20::CreateKey(key);
+}
+
+void OverwriteEngine::Configure(const ShredOptions& options)
+{
+    // Whole 64 KB units keep every block sector aligned
+    constexpr size_t unit = 64 * 1024;
+    blockSize = static_cast<DWORD>(max(unit, min(options.writeBlockSize, static_cast<size_t>(64 * 1024 * 1024)) / unit * unit));
+    queueDepth = max(1u, options.queueDepth);
+    verify = options.verify;
+    backgroundIo = options.backgroundIo;
+    trim = options.trim;
+    durabilityMode = options.durability;
+    passes = OverwritePass::ForScheme(options.scheme);
+    limiter.SetRate(options.maxBytesPerSecond);
+    bufferPool.Configure(blockSize, options.largePages);
+}
+
+// One port per delete worker, every file handle of that worker is bound to it
+HANDLE OverwriteEngine::GetCompletionPort()
+{
+    struct CompletionPort {
+        HANDLE handle = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+        ~CompletionPort() {
+            if (handle) {
+                CloseHandle(handle);
+            }
+        }
+    };
+    thread_local CompletionPort port;
+    return port.handle;
+}
+
+vector<BufferPool::Buffer*>& OverwriteEngine::GetBuffers()
+{
+    thread_local vector<BufferPool::Buffer*> buffers;
+    return buffers;
+}
+
+// Unbuffered writes must start and end on a sector boundary
+DWORD OverwriteEngine::GetSectorSize(HANDLE file)
+{
+    FILE_STORAGE_INFO storageInfo;
+    if (GetFileInformationByHandleEx(file, FileStorageInfo, &storageInfo, sizeof(storageInfo))
+        && storageInfo.LogicalBytesPerSector > 0) {
+        return storageInfo.LogicalBytesPerSector;
+    }
+
+    // Before Windows 8. A multiple of every common sector size.
+    return 4096;
+}
+
+OverwriteEngine::Result OverwriteEngine::ToResult(DWORD error)
+{
+    switch (error) {
+    case ERROR_FILE_NOT_FOUND:
+    case ERROR_PATH_NOT_FOUND:
+        return Result::Gone;
+    case ERROR_SHARING_VIOLATION:
+    case ERROR_LOCK_VIOLATION:
+    case ERROR_ACCESS_DENIED:
+        return Result::Locked;
+    default:
+        return Result::Failed;
+    }
+}
+
+// Constant content only depends on the pattern and where in the pattern the block
+// starts, so a buffer that already holds it is written again without refilling
+uint64_t OverwriteEngine::GetContentKey(const OverwritePass& pass, uint64_t offset)
+{
+    if (pass.kind != OverwritePass::Kind::Constant) {
+        return 0;
+    }
+
+    return 1
+        | static_cast<uint64_t>(pass.pattern[0]) << 8
+        | static_cast<uint64_t>(pass.pattern[1]) << 16
+        | static_cast<uint64_t>(pass.pattern[2]) << 24
+        | static_cast<uint64_t>(pass.patternLength) << 32
+        | static_cast<uint64_t>(offset % pass.patternLength) << 40;
+}
+
+void OverwriteEngine::FillBlock(void* buffer, size_t pass, uint64_t nonceBase, uint64_t offset, DWORD length) const
+{
+    const OverwritePass& current = passes[pass];
+    uint8_t* bytes = static_cast<uint8_t*>(buffer);
+
+    switch (current.kind) {
+    case OverwritePass::Kind::Constant: {
+        // Write one period, then keep doubling the filled part
+        DWORD period = min(static_cast<DWORD>(current.patternLength), length);
+        for (DWORD i = 0; i < period; i++) {
+            bytes[i] = current.pattern[(offset + i) % current.patternLength];
+        }
+        for (DWORD filled = period; filled < length;) {
+            DWORD copy = min(filled, length - filled);
+            memcpy(bytes + filled, bytes, copy);
+            filled += copy;
+        }
+        break;
+    }
+
+    case OverwritePass::Kind::Complement: {
+        FillBlock(buffer, pass - 1, nonceBase, offset, length);
+        DWORD i = 0;
+        for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, bytes + i, sizeof(word));
+            word = ~word;
+            memcpy(bytes + i, &word, sizeof(word));
+        }
+        for (; i < length; i++) {
+            bytes[i] = static_cast<uint8_t>(~bytes[i]);
+        }
+        break;
+    }
+
+    case OverwritePass::Kind::Random:
+        // Blocks start at multiples of 64, see the extent alignment
+        ChaCha20::Generate(key, nonceBase + pass, offset / ChaCha20::blockSize, buffer, length);
+        break;
+    }
+}
+
+const void* OverwriteEngine::PrepareBlock(BufferPool::Buffer& buffer, size_t pass, uint64_t nonceBase, uint64_t offset, DWORD length) const
+{
+    uint64_t content = GetContentKey(passes[pass], offset);
+    if (content == 0 || buffer.content != content) {
+        // Constant content is always generated for the whole buffer, so it fits every length
+        FillBlock(buffer.data, pass, nonceBase, offset, content == 0 ? length : bufferPool.GetBufferSize());
+        buffer.content = content;
+    }
+    return buffer.data;
+}
+
+bool OverwriteEngine::CanOverwrite()
+{
+    for (const OverwritePass& pass : passes) {
+        if (pass.kind == OverwritePass::Kind::Random && !hasKey) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+OverwriteEngine::Result OverwriteEngine::Overwrite(const wstring& path, DWORD attributes)
+{
+    if (!CanOverwrite()) {
+        return Result::Failed;
+    }
+
+    bool direct;
+    HANDLE file = OpenStream(path, queueDepth > 1, 0, direct);
+    if (file == INVALID_HANDLE_VALUE) {
+        return ToResult(GetLastError());
+    }
+
+    // The main stream and the alternate ones share the buffers
+    vector<BufferPool::Buffer*>& buffers = GetBuffers();
+    Result result = Result::Failed;
+    if (bufferPool.Borrow(queueDepth, buffers)) {
+        result = OverwriteStream(file, direct, queueDepth > 1, path, attributes);
+        if (result == Result::Done) {
+            result = OverwriteAlternateStreams(file, path, queueDepth > 1, attributes);
+        }
+        bufferPool.Return(buffers);
+        Commit(file, queueDepth > 1, result);
+    }
+
+    CloseHandle(file);
+    return result;
+}
+
+// One synchronous handle for the passes and the delete. A small file is a single write
+// per pass, so there is nothing to queue, and the sparse query, the completion port and
+// the second open for DeleteFile would cost more than the write itself.
+OverwriteEngine::Result OverwriteEngine::OverwriteAndDelete(const wstring& path, DWORD attributes, bool& deleted)
+{
+    deleted = false;
+    if (!CanOverwrite()) {
+        return Result::Failed;
+    }
+
+    bool direct;
+    HANDLE file = OpenStream(path, false, DELETE, direct);
+    if (file == INVALID_HANDLE_VALUE) {
+        return ToResult(GetLastError());
+    }
+
+    // Synchronous writes need a single buffer
+    vector<BufferPool::Buffer*>& buffers = GetBuffers();
+    Result result = Result::Failed;
+    if (bufferPool.Borrow(1, buffers)) {
+        result = OverwriteStream(file, direct, false, path, attributes & ~FILE_ATTRIBUTE_SPARSE_FILE);
+        if (result == Result::Done) {
+            result = OverwriteAlternateStreams(file, path, false, attributes);
+        }
+        bufferPool.Return(buffers);
+        Commit(file, false, result);
+    }
+
+    // A file that failed verification stays, like on the normal path
+    if (result == Result::Done) {
+        deleted = MarkForDeletion(file);
+    }
+
+    CloseHandle(file);
+    return result;
+}
+
+// Once per file, after the main and the alternate streams. A file that failed
+// verification is kept, so it is neither flushed for the delete nor trimmed.
+void OverwriteEngine::Commit(HANDLE file, bool overlapped, Result result)
+{
+    if (result != Result::Done) {
+        return;
+    }
+
+    if (durabilityMode == DurabilityMode::Batched) {
+        durability.Commit(file);
+    }
+
+    if (trim) {
+        Trim(file, overlapped);
+    }
+}
+
+// Tells the storage that the clusters of the main stream are free right away, instead of
+// when the file system trims them some time after the delete. A thin-provisioned LUN gets
+// the capacity back and an SSD can erase the blocks during garbage collection.
+// A disk could drop writes it still caches for trimmed blocks, so without write-through
+// or batched flushes the file is flushed first.
+// The trim is one request per file and cannot be batched per disk: FSCTL_FILE_LEVEL_TRIM
+// only takes ranges of the file behind the handle, and after the delete nothing names its
+// clusters any more. Trimming disk blocks directly would need administrator rights and
+// the cluster to block mapping, and could hit clusters the file system reused meanwhile.
+// The expensive part, the flush before it, is shared by the batched durability mode.
+void OverwriteEngine::Trim(HANDLE file, bool overlapped)
+{
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        return;
+    }
+
+    if (durabilityMode == DurabilityMode::None) {
+        FlushFileBuffers(file);
+    }
+
+    // One range over the whole stream, the file system rounds it to whole clusters and
+    // leaves out the holes of sparse files
+    FILE_LEVEL_TRIM trimInput = {};
+    trimInput.NumRanges = 1;
+    trimInput.Ranges[0].Offset = 0;
+    trimInput.Ranges[0].Length = fileSize.QuadPart;
+    FILE_LEVEL_TRIM_OUTPUT trimOutput = {};
+    DWORD returned = 0;
+    if (DeviceControl(file, overlapped, FSCTL_FILE_LEVEL_TRIM, &trimInput, sizeof(trimInput), &trimOutput, sizeof(trimOutput), returned)) {
+        bytesTrimmed += fileSize.QuadPart;
+    }
+}
+
+// POSIX semantics take the name away at once and the read-only flag does not matter.
+// File systems without FileDispositionInfoEx get the classic delete-on-close.
+bool OverwriteEngine::MarkForDeletion(HANDLE file)
+{
+    FILE_DISPOSITION_INFO_EX dispositionEx;
+    dispositionEx.Flags = FILE_DISPOSITION_FLAG_DELETE | FILE_DISPOSITION_FLAG_POSIX_SEMANTICS | FILE_DISPOSITION_FLAG_IGNORE_READONLY_ATTRIBUTE;
+    if (SetFileInformationByHandle(file, FileDispositionInfoEx, &dispositionEx, sizeof(dispositionEx))) {
+        return true;
+    }
+
+    FILE_DISPOSITION_INFO disposition;
+    disposition.DeleteFile = TRUE;
+    return SetFileInformationByHandle(file, FileDispositionInfo, &disposition, sizeof(disposition));
+}
+
+// The named streams are listed and opened through the handle of the file. The handle
+// stays open until they are done. The path only names a stream in the verify errors.
+OverwriteEngine::Result OverwriteEngine::OverwriteAlternateStreams(HANDLE file, const wstring& path, bool overlapped, DWORD attributes)
+{
+    thread_local vector<wstring> streamNames;
+    if (!ListAlternateStreams(file, streamNames)) {
+        return Result::Done;
+    }
+
+    thread_local wstring streamPath;
+    for (const wstring& name : streamNames) {
+        streamPath.assign(path).append(name);
+        bool direct;
+        HANDLE stream = OpenAlternateStream(file, name, overlapped, direct);
+        if (stream == INVALID_HANDLE_VALUE) {
+            Result result = ToResult(GetLastError());
+            if (result != Result::Gone) {
+                return result;
+            }
+            continue;
+        }
+
+        Result result = OverwriteStream(stream, direct, overlapped, streamPath, attributes);
+        CloseHandle(stream);
+        if (result != Result::Done) {
+            return result;
+        }
+    }
+
+    return Result::Done;
+}
+
+HANDLE OverwriteEngine::OpenStream(const wstring& path, bool overlapped, DWORD extraAccess, bool& direct) const
+{
+    constexpr DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    DWORD flags = FILE_FLAG_SEQUENTIAL_SCAN | (overlapped ? FILE_FLAG_OVERLAPPED : 0)
+        | (durabilityMode == DurabilityMode::WriteThrough ? FILE_FLAG_WRITE_THROUGH : 0);
+    direct = true;
+    DWORD access = GENERIC_WRITE | (verify ? GENERIC_READ : 0) | extraAccess;
+    HANDLE file = CreateFile(path.c_str(), access, share, nullptr, OPEN_EXISTING, flags | FILE_FLAG_NO_BUFFERING, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER) {
+        // Some network and virtual file systems refuse unbuffered handles
+        direct = false;
+        file = CreateFile(path.c_str(), access, share, nullptr, OPEN_EXISTING, flags, nullptr);
+    }
+
+    if (file != INVALID_HANDLE_VALUE) {
+        SetBackgroundPriority(file);
+    }
+    return file;
+}
+
+// Opens a named stream (":name:$DATA") relative to the open file, like a child relative
+// to its directory. Only the stream name is parsed, so the path is neither resolved nor
+// checked against MAX_PATH again, and the stream is always the one of this file.
+HANDLE OverwriteEngine::OpenAlternateStream(HANDLE file, const wstring& name, bool overlapped, bool& direct) const
+{
+    UNICODE_STRING objectName;
+    objectName.Buffer = const_cast<PWSTR>(name.c_str());
+    objectName.Length = static_cast<USHORT>(name.size() * sizeof(wchar_t));
+    objectName.MaximumLength = objectName.Length;
+
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, &objectName, OBJ_CASE_INSENSITIVE, file, nullptr);
+
+    // The same flags as OpenStream, in their native form. A synchronous handle needs
+    // SYNCHRONIZE, an overlapped one is simply opened without the synchronous option.
+    ACCESS_MASK access = GENERIC_WRITE | (verify ? GENERIC_READ : 0) | (overlapped ? 0 : SYNCHRONIZE);
+    ULONG options = FILE_NON_DIRECTORY_FILE | FILE_SEQUENTIAL_ONLY | (overlapped ? 0 : FILE_SYNCHRONOUS_IO_NONALERT)
+        | (durabilityMode == DurabilityMode::WriteThrough ? FILE_WRITE_THROUGH : 0);
+
+    direct = true;
+    HANDLE stream;
+    IO_STATUS_BLOCK ioStatus;
+    NTSTATUS status = NtOpenFile(&stream, access, &attributes, &ioStatus, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        options | FILE_NO_INTERMEDIATE_BUFFERING);
+    if (!NT_SUCCESS(status) && RtlNtStatusToDosError(status) == ERROR_INVALID_PARAMETER) {
+        direct = false;
+        status = NtOpenFile(&stream, access, &attributes, &ioStatus, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, options);
+    }
+
+    if (!NT_SUCCESS(status)) {
+        SetLastError(RtlNtStatusToDosError(status));
+        return INVALID_HANDLE_VALUE;
+    }
+
+    SetBackgroundPriority(stream);
+    return stream;
+}
+
+// The disk stack serves very low priority requests after all others, the hint is
+// ignored where the file system does not support it
+void OverwriteEngine::SetBackgroundPriority(HANDLE file) const
+{
+    if (backgroundIo) {
+        FILE_IO_PRIORITY_HINT_INFO priority;
+        priority.PriorityHint = IoPriorityHintVeryLow;
+        SetFileInformationByHandle(file, FileIoPriorityHintInfo, &priority, sizeof(priority));
+    }
+}
+
+// Names (":name:$DATA") of the non-empty alternate data streams of the file. False when
+// there are none or the file system has no streams.
+bool OverwriteEngine::ListAlternateStreams(HANDLE file, vector<wstring>& names)
+{
+    thread_local vector<uint64_t> buffer(1024);
+    names.clear();
+
+    DWORD bufferSize = static_cast<DWORD>(buffer.size() * sizeof(uint64_t));
+    while (!GetFileInformationByHandleEx(file, FileStreamInfo, buffer.data(), bufferSize)) {
+        if (GetLastError() != ERROR_MORE_DATA || buffer.size() >= maxStreamInfoSize / sizeof(uint64_t)) {
+            return false;
+        }
+        buffer.resize(buffer.size() * 2);
+        bufferSize = static_cast<DWORD>(buffer.size() * sizeof(uint64_t));
+    }
+
+    const uint8_t* position = reinterpret_cast<const uint8_t*>(buffer.data());
+    for (;;) {
+        const FILE_STREAM_INFO* info = reinterpret_cast<const FILE_STREAM_INFO*>(position);
+        wstring_view name(info->StreamName, info->StreamNameLength / sizeof(WCHAR));
+        if (name != L"::$DATA" && info->StreamSize.QuadPart > 0) {
+            names.emplace_back(name);
+        }
+
+        if (info->NextEntryOffset == 0) {
+            break;
+        }
+        position += info->NextEntryOffset;
+    }
+
+    return !names.empty();
+}
+
+// All passes over one open stream, the default one or a named one
+OverwriteEngine::Result OverwriteEngine::OverwriteStream(HANDLE file, bool direct, bool overlapped, const wstring& path, DWORD attributes)
+{
+    // Completions of the overlapped writes go to the port of this thread
+    HANDLE port = overlapped ? GetCompletionPort() : nullptr;
+    LARGE_INTEGER fileSize;
+    if ((overlapped && (!port || !CreateIoCompletionPort(file, port, 0, 0))) || !GetFileSizeEx(file, &fileSize)) {
+        return Result::Failed;
+    }
+
+    // The tail is written as a whole sector and cut back to the real size afterwards
+    uint64_t size = fileSize.QuadPart;
+    uint64_t sector = direct ? GetSectorSize(file) : 1;
+    uint64_t roundedSize = (size + sector - 1) / sector * sector;
+
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        FILE_BASIC_INFO basicInfo;
+        attributes = GetFileInformationByHandleEx(file, FileBasicInfo, &basicInfo, sizeof(basicInfo)) ? basicInfo.FileAttributes : 0;
+    }
+
+    // Holes of sparse files stay holes, writing them would allocate the whole logical size
+    vector<Range> extents;
+    if (!(attributes & FILE_ATTRIBUTE_SPARSE_FILE) || !QueryAllocatedRanges(file, overlapped, roundedSize, max(sector, static_cast<uint64_t>(ChaCha20::blockSize)), extents)) {
+        extents.assign(1, { 0, roundedSize });
+    }
+
+    // With write-through every pass reaches the disk before the next one starts. Otherwise
+    // the disk cache may merge the passes, only the last one is sure to be written.
+    uint64_t nonceBase = nextNonce.fetch_add(passes.size());
+    Result result = Result::Done;
+    for (size_t pass = 0; pass < passes.size() && result == Result::Done; pass++) {
+        result = overlapped ? TransferQueued(file, extents, size, pass, nonceBase, nullptr) : TransferSequential(file, extents, size, pass, nonceBase, nullptr);
+    }
+
+    if (roundedSize != size) {
+        FILE_END_OF_FILE_INFO endOfFile;
+        endOfFile.EndOfFile.QuadPart = size;
+        SetFileInformationByHandle(file, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile));
+    }
+
+    // Deleting a file drops its dirty cached pages. In batched mode the commit after the
+    // last stream flushes them.
+    if (!direct && durabilityMode != DurabilityMode::Batched) {
+        FlushFileBuffers(file);
+    }
+
+    // Reads the file back after the tail was cut, so the last block ends at the real size.
+    // Without the unbuffered handle the data comes from the cache and only checks the writes.
+    if (verify && result == Result::Done && !passes.empty()) {
+        vector<Range> ranges;
+        size_t lastPass = passes.size() - 1;
+        result = overlapped ? TransferQueued(file, extents, size, lastPass, nonceBase, &ranges) : TransferSequential(file, extents, size, lastPass, nonceBase, &ranges);
+        if (result == Result::Done && !ranges.empty()) {
+            RecordMismatches(path, ranges);
+            result = Result::Mismatch;
+        }
+    }
+
+    return result;
+}
+
+// Compares what was read at offset with what the pass wrote there, up to the real end
+// of the file. A short read counts the missing bytes as mismatching.
+void OverwriteEngine::CompareBlock(const void* data, DWORD length, uint64_t offset, DWORD expectedLength, size_t pass, uint64_t nonceBase, vector<Range>& mismatches) const
+{
+    thread_local vector<uint8_t> expected;
+    expected.resize(blockSize);
+    FillBlock(expected.data(), pass, nonceBase, offset, expectedLength);
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    DWORD compared = min(length, expectedLength);
+    for (size_t position = 0; position < compared;) {
+        position += BlockCompare::FindMismatch(bytes + position, expected.data() + position, compared - position);
+        if (position == compared) {
+            break;
+        }
+
+        size_t end = position + BlockCompare::FindMatch(bytes + position, expected.data() + position, compared - position);
+        mismatches.push_back({ offset + position, end - position });
+        position = end;
+    }
+
+    if (compared < expectedLength) {
+        mismatches.push_back({ offset + compared, static_cast<uint64_t>(expectedLength - compared) });
+    }
+}
+
+void OverwriteEngine::RecordMismatches(const wstring& path, vector<Range>& ranges)
+{
+    // Queued reads complete in any order
+    sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) { return a.offset < b.offset; });
+
+    vector<Range> merged;
+    for (const Range& range : ranges) {
+        if (!merged.empty() && merged.back().offset + merged.back().length == range.offset) {
+            merged.back().length += range.length;
+        }
+        else {
+            merged.push_back(range);
+        }
+    }
+
+    mismatchCount += merged.size();
+    lock_guard<mutex> lock(mismatchesMutex);
+    for (const Range& range : merged) {
+        if (mismatches.size() >= maxRecordedMismatches) {
+            break;
+        }
+        mismatches.push_back({ path, range.offset, range.length });
+    }
+}
+
+// Allocated ranges of a sparse file up to size, widened to whole alignment units
+bool OverwriteEngine::QueryAllocatedRanges(HANDLE file, bool overlapped, uint64_t size, uint64_t alignment, vector<Range>& extents)
+{
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    query.FileOffset.QuadPart = 0;
+    query.Length.QuadPart = size;
+    FILE_ALLOCATED_RANGE_BUFFER ranges[64];
+
+    while (query.Length.QuadPart > 0) {
+        DWORD returned = 0;
+        bool more = false;
+        if (!DeviceControl(file, overlapped, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), ranges, sizeof(ranges), returned)) {
+            if (GetLastError() != ERROR_MORE_DATA) {
+                return false;
+            }
+            more = true;
+        }
+
+        size_t count = returned / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+        for (size_t i = 0; i < count; i++) {
+            uint64_t rangeStart = ranges[i].FileOffset.QuadPart;
+            uint64_t rangeEnd = rangeStart + ranges[i].Length.QuadPart;
+            uint64_t start = rangeStart / alignment * alignment;
+            uint64_t end = min(size, (rangeEnd + alignment - 1) / alignment * alignment);
+            if (!extents.empty() && extents.back().offset + extents.back().length >= start) {
+                extents.back().length = max(extents.back().length, end - extents.back().offset);
+            }
+            else if (end > start) {
+                extents.push_back({ start, end - start });
+            }
+        }
+
+        if (!more || count == 0) {
+            break;
+        }
+
+        const FILE_ALLOCATED_RANGE_BUFFER& last = ranges[count - 1];
+        query.FileOffset.QuadPart = last.FileOffset.QuadPart + last.Length.QuadPart;
+        query.Length.QuadPart = size - min(size, static_cast<uint64_t>(query.FileOffset.QuadPart));
+    }
+
+    return true;
+}
+
+// DeviceIoControl that also works on the overlapped handles of the queued mode. The low
+// bit of the event keeps the completion away from the completion port.
+bool OverwriteEngine::DeviceControl(HANDLE file, bool overlapped, DWORD code, void* input, DWORD inputSize, void* output, DWORD outputSize, DWORD& returned)
+{
+    if (!overlapped) {
+        return DeviceIoControl(file, code, input, inputSize, output, outputSize, &returned, nullptr);
+    }
+
+    HANDLE event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!event) {
+        return false;
+    }
+
+    OVERLAPPED request = OVERLAPPED();
+    request.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(event) | 1);
+    BOOL succeeded = DeviceIoControl(file, code, input, inputSize, output, outputSize, &returned, &request);
+    if (!succeeded && GetLastError() == ERROR_IO_PENDING) {
+        succeeded = GetOverlappedResult(file, &request, &returned, TRUE);
+    }
+
+    DWORD error = GetLastError();
+    CloseHandle(event);
+    SetLastError(error);
+    return succeeded;
+}
+
+// Next block of at most blockSize bytes at or after offset, moving on to the next extent
+// when the current one is used up
+bool OverwriteEngine::NextBlock(const vector<Range>& extents, size_t& extent, uint64_t& offset, DWORD& length) const
+{
+    while (extent < extents.size() && offset >= extents[extent].offset + extents[extent].length) {
+        if (++extent < extents.size()) {
+            offset = extents[extent].offset;
+        }
+    }
+
+    if (extent >= extents.size()) {
+        return false;
+    }
+
+    length = static_cast<DWORD>(min(static_cast<uint64_t>(blockSize), extents[extent].offset + extents[extent].length - offset));
+    return true;
+}
+
+OverwriteEngine::Result OverwriteEngine::TransferSequential(HANDLE file, const vector<Range>& extents, uint64_t validSize, size_t pass, uint64_t nonceBase, vector<Range>* mismatches)
+{
+    BufferPool::Buffer& buffer = *GetBuffers()[0];
+    size_t extent = 0;
+    uint64_t offset = extents.empty() ? 0 : extents[0].offset;
+    uint64_t position = UINT64_MAX;
+    DWORD length;
+    while (NextBlock(extents, extent, offset, length)) {
+        if (IsCancelled()) {
+            return Result::Cancelled;
+        }
+        limiter.Acquire(length);
+
+        // Only seeks at the start and between extents
+        if (offset != position) {
+            LARGE_INTEGER start;
+            start.QuadPart = offset;
+            if (!SetFilePointerEx(file, start, nullptr, FILE_BEGIN)) {
+                return Result::Failed;
+            }
+        }
+
+        if (mismatches) {
+            DWORD read = 0;
+            buffer.content = 0;
+            if (!ReadFile(file, buffer.data, length, &read, nullptr)) {
+                return ToResult(GetLastError());
+            }
+            DWORD expectedLength = static_cast<DWORD>(min(static_cast<uint64_t>(length), validSize - offset));
+            CompareBlock(buffer.data, read, offset, expectedLength, pass, nonceBase, *mismatches);
+        }
+        else {
+            const void* data = PrepareBlock(buffer, pass, nonceBase, offset, length);
+            DWORD written = 0;
+            if (!WriteFile(file, data, length, &written, nullptr) || written != length) {
+                return ToResult(GetLastError());
+            }
+            bytesWritten += length;
+            writesCompleted++;
+        }
+
+        offset += length;
+        position = offset;
+    }
+
+    return Result::Done;
+}
+
+// Keeps up to queueDepth requests in flight. Every request has its own OVERLAPPED with the
+// offset and its own buffer.
+OverwriteEngine::Result OverwriteEngine::TransferQueued(HANDLE file, const vector<Range>& extents, uint64_t validSize, size_t pass, uint64_t nonceBase, vector<Range>* mismatches)
+{
+    thread_local vector<OVERLAPPED> requests;
+    thread_local vector<DWORD> lengths;
+    HANDLE port = GetCompletionPort();
+
+    vector<BufferPool::Buffer*>& buffers = GetBuffers();
+    requests.resize(queueDepth);
+    lengths.resize(queueDepth);
+    vector<size_t> freeRequests;
+    freeRequests.reserve(queueDepth);
+    for (size_t i = 0; i < requests.size(); i++) {
+        freeRequests.push_back(i);
+    }
+
+    Result result = Result::Done;
+    size_t extent = 0;
+    uint64_t offset = extents.empty() ? 0 : extents[0].offset;
+    DWORD length;
+    bool more = NextBlock(extents, extent, offset, length);
+    unsigned int inFlight = 0;
+    while (inFlight > 0 || (more && result == Result::Done)) {
+        if (result == Result::Done && IsCancelled()) {
+            result = Result::Cancelled;
+        }
+
+        // Fill the queue, stop issuing after the first error but collect what is in flight
+        while (more && result == Result::Done && !freeRequests.empty()) {
+            limiter.Acquire(length);
+            size_t slot = freeRequests.back();
+            freeRequests.pop_back();
+
+            OVERLAPPED* request = &requests[slot];
+            *request = OVERLAPPED();
+            request->Offset = static_cast<DWORD>(offset);
+            request->OffsetHigh = static_cast<DWORD>(offset >> 32);
+            lengths[slot] = length;
+
+            // Also a request that finishes right away posts its completion to the port
+            BOOL issued;
+            if (mismatches) {
+                buffers[slot]->content = 0;
+                issued = ReadFile(file, buffers[slot]->data, length, nullptr, request);
+            }
+            else {
+                issued = WriteFile(file, PrepareBlock(*buffers[slot], pass, nonceBase, offset, length), length, nullptr, request);
+            }
+
+            if (!issued && GetLastError() != ERROR_IO_PENDING) {
+                result = ToResult(GetLastError());
+                freeRequests.push_back(slot);
+                break;
+            }
+
+            offset += length;
+            more = NextBlock(extents, extent, offset, length);
+            inFlight++;
+        }
+
+        if (inFlight == 0) {
+            break;
+        }
+
+        DWORD transferred = 0;
+        ULONG_PTR completionKey = 0;
+        OVERLAPPED* completed = nullptr;
+        if (!GetQueuedCompletionStatus(port, &transferred, &completionKey, &completed, INFINITE)) {
+            if (!completed) {
+                // The port itself failed, nothing can be collected any more
+                return Result::Failed;
+            }
+            result = ToResult(GetLastError());
+        }
+        else if (mismatches) {
+            size_t slot = completed - requests.data();
+            uint64_t completedOffset = (static_cast<uint64_t>(completed->OffsetHigh) << 32) | completed->Offset;
+            DWORD expectedLength = static_cast<DWORD>(min(static_cast<uint64_t>(lengths[slot]), validSize - completedOffset));
+            CompareBlock(buffers[slot]->data, transferred, completedOffset, expectedLength, pass, nonceBase, *mismatches);
+        }
+        else {
+            bytesWritten += transferred;
+            writesCompleted++;
+        }
+
+        inFlight--;
+        freeRequests.push_back(completed - requests.data());
+    }
+
+    return result;
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include "ShredOptions.h"
+#include "OverwritePass.h"
+#include "RateLimiter.h"
+#include "BufferPool.h"
+#include "DurabilityBarrier.h"
+
+using namespace std;
+
+// Overwrites the contents of a file in place, once per pass of the configured scheme,
+// including its alternate data streams. The file is opened without the system
+// cache, so shredding does not evict other programs' cached pages. The durability mode
+// decides how the data is brought onto the disk before the file is deleted, with
+// write-through on every write or with flushes shared by many files.
+// With a queue depth above one, several overlapped writes per file are kept in flight
+// through a completion port of the calling thread, so fast drives are not limited to
+// one request at a time.
+class OverwriteEngine {
+public:
+    // Files up to this size take OverwriteAndDelete
+    static constexpr uint64_t smallFileSize = 64 * 1024;
+
+    enum class Result {
+        Done,
+        // The file disappeared after the scan
+        Gone,
+        // Another process holds the file or access was denied
+        Locked,
+        // The verify pass read back data that differs from the last pass
+        Mismatch,
+        // Stopped through the cancellation flag, the file is partly overwritten
+        Cancelled,
+        Failed
+    };
+
+    struct Mismatch {
+        wstring path;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+private:
+    struct Range {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    // Stream listings beyond this are not grown into, the streams are then left alone
+    static constexpr size_t maxStreamInfoSize = 16 * 1024 * 1024;
+
+    // Only the first ones are kept, a dying disk could otherwise fill the memory
+    static constexpr size_t maxRecordedMismatches = 1000;
+
+    DWORD blockSize = 1024 * 1024;
+    unsigned int queueDepth = 1;
+    bool verify = false;
+    bool backgroundIo = false;
+    bool trim = false;
+    DurabilityMode durabilityMode = DurabilityMode::WriteThrough;
+    vector<OverwritePass> passes;
+    RateLimiter limiter;
+    BufferPool bufferPool;
+    DurabilityBarrier durability;
+    atomic<bool>* cancellation = nullptr;
+
+    // Random passes are ChaCha20 streams under this key. Every random pass of every file
+    // gets its own nonce, so the data can be regenerated from (nonce, offset).
+    uint32_t key[8] = {};
+    bool hasKey = false;
+    atomic<uint64_t> nextNonce{ 0 };
+
+    atomic<uint64_t> bytesWritten{ 0 };
+    atomic<uint64_t> writesCompleted{ 0 };
+    atomic<uint64_t> bytesTrimmed{ 0 };
+    atomic<uint64_t> mismatchCount{ 0 };
+    vector<Mismatch> mismatches;
+    mutable mutex mismatchesMutex;
+
+    bool IsCancelled() const {
+        return cancellation && *cancellation;
+    }
+
+    static DWORD GetSectorSize(HANDLE file);
+    static Result ToResult(DWORD error);
+    static uint64_t GetContentKey(const OverwritePass& pass, uint64_t offset);
+
+    static HANDLE GetCompletionPort();
+    // Buffers the calling thread borrowed for the file it works on, one per request in flight
+    static vector<BufferPool::Buffer*>& GetBuffers();
+    const void* PrepareBlock(BufferPool::Buffer& buffer, size_t pass, uint64_t nonceBase, uint64_t offset, DWORD length) const;
+    void FillBlock(void* buffer, size_t pass, uint64_t nonceBase, uint64_t offset, DWORD length) const;
+
+    bool CanOverwrite();
+    void Commit(HANDLE file, bool overlapped, Result result);
+    void Trim(HANDLE file, bool overlapped);
+    HANDLE OpenStream(const wstring& path, bool overlapped, DWORD extraAccess, bool& direct) const;
+    HANDLE OpenAlternateStream(HANDLE file, const wstring& name, bool overlapped, bool& direct) const;
+    void SetBackgroundPriority(HANDLE file) const;
+    static bool ListAlternateStreams(HANDLE file, vector<wstring>& names);
+    Result OverwriteStream(HANDLE file, bool direct, bool overlapped, const wstring& path, DWORD attributes);
+    Result OverwriteAlternateStreams(HANDLE file, const wstring& path, bool overlapped, DWORD attributes);
+
+    static bool QueryAllocatedRanges(HANDLE file, bool overlapped, uint64_t size, uint64_t alignment, vector<Range>& extents);
+    static bool DeviceControl(HANDLE file, bool overlapped, DWORD code, void* input, DWORD inputSize, void* output, DWORD outputSize, DWORD& returned);
+    bool NextBlock(const vector<Range>& extents, size_t& extent, uint64_t& offset, DWORD& length) const;
+
+    // Without mismatches the pass is written, with it the file is read back and compared.
+    // The extents are rounded to whole sectors, validSize is the real file size.
+    Result TransferSequential(HANDLE file, const vector<Range>& extents, uint64_t validSize, size_t pass, uint64_t nonceBase, vector<Range>* mismatches);
+    Result TransferQueued(HANDLE file, const vector<Range>& extents, uint64_t validSize, size_t pass, uint64_t nonceBase, vector<Range>* mismatches);
+    void CompareBlock(const void* data, DWORD length, uint64_t offset, DWORD expectedLength, size_t pass, uint64_t nonceBase, vector<Range>& mismatches) const;
+    void RecordMismatches(const wstring& path, vector<Range>& ranges);
+
+public:
+    OverwriteEngine();
+    OverwriteEngine(const OverwriteEngine&) = delete;
+    OverwriteEngine& operator=(const OverwriteEngine&) = delete;
+
+    // Not thread-safe, call before the first Overwrite
+    void Configure(const ShredOptions& options);
+
+    // Deletes the file or empty directory when the handle is closed. The handle needs
+    // DELETE access.
+    static bool MarkForDeletion(HANDLE file);
+
+    // Thread-safe, takes effect with the next write of every worker. 0 = unlimited.
+    void SetMaxRate(uint64_t bytesPerSecond) {
+        limiter.SetRate(bytesPerSecond);
+    }
+
+    uint64_t GetMaxRate() const {
+        return limiter.GetRate();
+    }
+
+    // Stops the passes of every file between two writes once the flag is set
+    void SetCancellation(atomic<bool>* value) {
+        cancellation = value;
+        limiter.SetCancellation(value);
+    }
+
+    // Thread-safe. attributes are the ones the scan recorded, they tell sparse files apart
+    // without another query.
+    Result Overwrite(const wstring& path, DWORD attributes = INVALID_FILE_ATTRIBUTES);
+
+    // Thread-safe. Overwrite for files up to smallFileSize that also deletes the file
+    // through the same handle. deleted tells whether that worked, the caller falls back to
+    // DeleteFile otherwise.
+    Result OverwriteAndDelete(const wstring& path, DWORD attributes, bool& deleted);
+
+    size_t GetPassCount() const {
+        return passes.size();
+    }
+
+    // Totals since the start over all passes, for throughput figures
+    uint64_t GetBytesWritten() const {
+        return bytesWritten;
+    }
+
+    uint64_t GetWritesCompleted() const {
+        return writesCompleted;
+    }
+
+    // Main stream bytes the storage accepted trims for
+    uint64_t GetBytesTrimmed() const {
+        return bytesTrimmed;
+    }
+
+    // Mismatching ranges found by the verify pass, merged per file
+    uint64_t GetMismatchCount() const {
+        return mismatchCount;
+    }
+
+    // Flushes of the batched durability mode
+    const DurabilityBarrier& GetDurability() const {
+        return durability;
+    }
+
+    // Write buffers of all workers, for allocation figures
+    const BufferPool& GetBufferPool() const {
+        return bufferPool;
+    }
+
+    vector<Mismatch> GetMismatches() const {
+        lock_guard<mutex> lock(mismatchesMutex);
+        return mismatches;
+    }
+};
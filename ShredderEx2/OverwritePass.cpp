@@ -0,0 +1,69 @@
+#include "OverwritePass.h"
+
+OverwritePass OverwritePass::Constant(uint8_t value)
+{
+    OverwritePass pass;
+    pass.pattern[0] = value;
+    return pass;
+}
+
+OverwritePass OverwritePass::Constant(uint8_t first, uint8_t second, uint8_t third)
+{
+    OverwritePass pass;
+    pass.pattern[0] = first;
+    pass.pattern[1] = second;
+    pass.pattern[2] = third;
+    pass.patternLength = 3;
+    return pass;
+}
+
+OverwritePass OverwritePass::Complement()
+{
+    OverwritePass pass;
+    pass.kind = Kind::Complement;
+    return pass;
+}
+
+OverwritePass OverwritePass::Random()
+{
+    OverwritePass pass;
+    pass.kind = Kind::Random;
+    return pass;
+}
+
+vector<OverwritePass> OverwritePass::ForScheme(OverwriteScheme scheme)
+{
+    switch (scheme) {
+    case OverwriteScheme::DoD:
+        // DoD 5220.22-M: a character, its complement, then random data
+        return { Constant(0x00), Complement(), Random() };
+
+    case OverwriteScheme::Random:
+        return { Random() };
+
+    case OverwriteScheme::Gutmann: {
+        // 4 random passes, the 27 fixed MFM/RLL patterns, 4 random passes
+        vector<OverwritePass> passes(4, Random());
+        passes.push_back(Constant(0x55));
+        passes.push_back(Constant(0xAA));
+        passes.push_back(Constant(0x92, 0x49, 0x24));
+        passes.push_back(Constant(0x49, 0x24, 0x92));
+        passes.push_back(Constant(0x24, 0x92, 0x49));
+        for (int value = 0x00; value <= 0xFF; value += 0x11) {
+            passes.push_back(Constant(static_cast<uint8_t>(value)));
+        }
+        passes.push_back(Constant(0x92, 0x49, 0x24));
+        passes.push_back(Constant(0x49, 0x24, 0x92));
+        passes.push_back(Constant(0x24, 0x92, 0x49));
+        passes.push_back(Constant(0x6D, 0xB6, 0xDB));
+        passes.push_back(Constant(0xB6, 0xDB, 0x6D));
+        passes.push_back(Constant(0xDB, 0x6D, 0xB6));
+        passes.insert(passes.end(), 4, Random());
+        return passes;
+    }
+
+    case OverwriteScheme::Zeros:
+    default:
+        return { Constant(0x00) };
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "ShredOptions.h"
+
+using namespace std;
+
+// One pass over the whole file
+struct OverwritePass {
+    enum class Kind {
+        // pattern repeated from the start of the file
+        Constant,
+        // Every byte of the previous pass inverted
+        Complement,
+        // ChaCha20 keystream
+        Random
+    };
+
+    Kind kind = Kind::Constant;
+    uint8_t pattern[3] = {};
+    uint8_t patternLength = 1;
+
+    static OverwritePass Constant(uint8_t value);
+    static OverwritePass Constant(uint8_t first, uint8_t second, uint8_t third);
+    static OverwritePass Complement();
+    static OverwritePass Random();
+
+    static vector<OverwritePass> ForScheme(OverwriteScheme scheme);
+};
@@ -0,0 +1,128 @@
+#include "ParentDirectory.h"
+#include <winternl.h>
+#include "OverwriteEngine.h"
+
+#pragma comment(lib, "ntdll.lib")
+
+#ifndef FILE_SUPPORTS_POSIX_UNLINK_RENAME
+#define FILE_SUPPORTS_POSIX_UNLINK_RENAME 0x00000400
+#endif
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(status) (static_cast<NTSTATUS>(status) >= 0)
+#endif
+
+ParentDirectory::~ParentDirectory()
+{
+    if (handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(handle);
+    }
+}
+
+ParentDirectory& ParentDirectory::Current()
+{
+    thread_local ParentDirectory parent;
+    return parent;
+}
+
+bool ParentDirectory::Split(const wstring& path, wstring_view& directory, wstring_view& name)
+{
+    size_t end = path.find_last_not_of(L'\\');
+    if (end == wstring::npos) {
+        return false;
+    }
+
+    size_t separator = path.find_last_of(L'\\', end);
+    if (separator == wstring::npos) {
+        return false;
+    }
+
+    directory = wstring_view(path).substr(0, separator + 1);
+    name = wstring_view(path).substr(separator + 1, end - separator);
+    return true;
+}
+
+HANDLE ParentDirectory::Open(wstring_view directoryPath)
+{
+    ParentDirectory& parent = Current();
+    if (parent.handle != INVALID_HANDLE_VALUE && parent.path == directoryPath) {
+        return parent.handle;
+    }
+
+    if (parent.handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(parent.handle);
+    }
+
+    // Shared for delete, so holding it does not keep the directory from being removed
+    parent.path = directoryPath;
+    parent.handle = CreateFile(parent.path.c_str(), FILE_TRAVERSE | FILE_ADD_FILE | FILE_ADD_SUBDIRECTORY | SYNCHRONIZE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+
+    DWORD flags = 0;
+    parent.keep = parent.handle != INVALID_HANDLE_VALUE
+        && GetVolumeInformationByHandleW(parent.handle, nullptr, 0, nullptr, nullptr, &flags, nullptr, 0)
+        && (flags & FILE_SUPPORTS_POSIX_UNLINK_RENAME);
+    return parent.handle;
+}
+
+void ParentDirectory::Release()
+{
+    ParentDirectory& parent = Current();
+    if (parent.handle != INVALID_HANDLE_VALUE && !parent.keep) {
+        CloseHandle(parent.handle);
+        parent.handle = INVALID_HANDLE_VALUE;
+    }
+}
+
+HANDLE ParentDirectory::OpenChild(HANDLE directory, wstring_view name, DWORD access)
+{
+    UNICODE_STRING objectName;
+    objectName.Buffer = const_cast<PWSTR>(name.data());
+    objectName.Length = static_cast<USHORT>(name.size() * sizeof(wchar_t));
+    objectName.MaximumLength = objectName.Length;
+
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, &objectName, OBJ_CASE_INSENSITIVE, directory, nullptr);
+
+    HANDLE child;
+    IO_STATUS_BLOCK ioStatus;
+    NTSTATUS status = NtOpenFile(&child, access | SYNCHRONIZE, &attributes, &ioStatus, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        FILE_OPEN_REPARSE_POINT | FILE_OPEN_FOR_BACKUP_INTENT | FILE_SYNCHRONOUS_IO_NONALERT);
+    if (!NT_SUCCESS(status)) {
+        SetLastError(RtlNtStatusToDosError(status));
+        return INVALID_HANDLE_VALUE;
+    }
+    return child;
+}
+
+bool ParentDirectory::DeleteChild(const wstring& path, bool& opened)
+{
+    opened = false;
+    wstring_view directoryPath;
+    wstring_view name;
+    if (!Split(path, directoryPath, name)) {
+        SetLastError(ERROR_INVALID_NAME);
+        return false;
+    }
+
+    HANDLE directory = Open(directoryPath);
+    if (directory == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    HANDLE entry = OpenChild(directory, name, DELETE);
+    if (entry == INVALID_HANDLE_VALUE) {
+        DWORD error = GetLastError();
+        Release();
+        SetLastError(error);
+        return false;
+    }
+    opened = true;
+
+    bool deleted = OverwriteEngine::MarkForDeletion(entry);
+    DWORD error = GetLastError();
+    CloseHandle(entry);
+    Release();
+    SetLastError(error);
+    return deleted;
+}
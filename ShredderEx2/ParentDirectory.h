@@ -0,0 +1,53 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Handle of the directory a worker currently deletes in. Files of one directory come
+// mostly one after another, so every thread keeps the handle of the directory it worked
+// in last and opens it once per directory and not per file.
+// Only volumes with POSIX deletes get the handle kept. Elsewhere, e.g. on FAT, exFAT or
+// SMB, an open handle keeps an emptied directory delete-pending and its parent not
+// empty, and no worker knows which handles the others still hold, so it is closed after
+// every use there.
+// Entries are opened relative to it with NtOpenFile. Only their name is parsed, so
+// neither the depth of the tree nor MAX_PATH matter for them.
+class ParentDirectory {
+private:
+    wstring path;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    bool keep = false;
+
+    ParentDirectory() = default;
+    ~ParentDirectory();
+    ParentDirectory(const ParentDirectory&) = delete;
+    ParentDirectory& operator=(const ParentDirectory&) = delete;
+
+    static ParentDirectory& Current();
+
+public:
+    // Splits path into its directory, with the backslash, and its name. Trailing
+    // backslashes are ignored, so "C:\dir" gives "C:" and "dir". False for a path
+    // without a parent, e.g. a drive root.
+    static bool Split(const wstring& path, wstring_view& directory, wstring_view& name);
+
+    // The handle of the calling thread for directoryPath, which ends with a backslash.
+    // It stays valid until the thread calls Release.
+    static HANDLE Open(wstring_view directoryPath);
+
+    // Ends the use of the handle from Open. It stays cached only where deletes have
+    // POSIX semantics.
+    static void Release();
+
+    // Opens name inside directory without following a link, e.g. with DELETE access.
+    // Returns INVALID_HANDLE_VALUE and sets the last error on failure.
+    static HANDLE OpenChild(HANDLE directory, wstring_view name, DWORD access);
+
+    // Deletes a file or an empty directory relative to the handle of its parent. Returns
+    // false and sets the last error like DeleteFile and RemoveDirectory. opened is false
+    // if the entry could not be opened that way, then DeleteFile or RemoveDirectory may
+    // still work, e.g. for a parent that does not grant adding entries.
+    static bool DeleteChild(const wstring& path, bool& opened);
+};
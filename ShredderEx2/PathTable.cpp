@@ -0,0 +1,278 @@
+#include "PathTable.h"
+#include <cwchar>
+#include <stdexcept>
+
+PathTable::PathTable()
+    : nodeBlocks(make_unique<unique_ptr<Node[]>[]>(maxNodeBlocks)),
+      metadataBlocks(make_unique<unique_ptr<EntryMetadata[]>[]>(maxNodeBlocks)),
+      pendingBlocks(make_unique<unique_ptr<atomic<uint32_t>[]>[]>(maxNodeBlocks)),
+      nameChunks(make_unique<unique_ptr<wchar_t[]>[]>(maxNameChunks))
+{
+    internSlots.resize(1024);
+}
+
+void PathTable::EnableReclaim()
+{
+    reclaim = true;
+    liveNodes = make_unique<atomic<uint32_t>[]>(maxNodeBlocks);
+    liveNames = make_unique<atomic<uint32_t>[]>(maxNameChunks);
+}
+
+PathTable::Handle PathTable::AddRoot(wstring_view path, const EntryMetadata& metadata)
+{
+    lock_guard<mutex> lock(addMutex);
+    return AddLocked(NoNode, path, metadata);
+}
+
+PathTable::Handle PathTable::AddChild(Handle parent, wstring_view name, const EntryMetadata& metadata)
+{
+    lock_guard<mutex> lock(addMutex);
+    return AddLocked(parent, name, metadata);
+}
+
+PathTable::Handle PathTable::AddChildren(Handle parent, const NewChild* children, size_t count)
+{
+    lock_guard<mutex> lock(addMutex);
+    Handle first = nodeCount;
+    for (size_t i = 0; i < count; i++) {
+        AddLocked(parent, children[i].name, children[i].metadata);
+    }
+    return first;
+}
+
+PathTable::Handle PathTable::AddLocked(Handle parent, wstring_view name, const EntryMetadata& metadata)
+{
+    uint32_t index = nodeCount.load(memory_order_relaxed);
+    if (index == NoNode) {
+        throw length_error("PathTable is full");
+    }
+
+    unique_ptr<Node[]>& block = nodeBlocks[index >> nodeBlockBits];
+    unique_ptr<EntryMetadata[]>& metadataBlock = metadataBlocks[index >> nodeBlockBits];
+    unique_ptr<atomic<uint32_t>[]>& pendingBlock = pendingBlocks[index >> nodeBlockBits];
+    if (!block) {
+        block = make_unique<Node[]>(size_t(1) << nodeBlockBits);
+        metadataBlock = make_unique<EntryMetadata[]>(size_t(1) << nodeBlockBits);
+        pendingBlock = make_unique<atomic<uint32_t>[]>(size_t(1) << nodeBlockBits);
+        // The previous block may have been retired completely while it was still filling
+        if (reclaim && index > 0) {
+            FreeBlockLocked((index >> nodeBlockBits) - 1);
+        }
+    }
+
+    Node& node = block[index & ((1u << nodeBlockBits) - 1)];
+    if (reclaim) {
+        // A shared name could not be freed with the nodes that use it
+        node.nameOffset = StoreName(name);
+        liveNames[node.nameOffset >> nameChunkBits]++;
+        liveNodes[index >> nodeBlockBits]++;
+    }
+    else {
+        node.nameOffset = Intern(name);
+    }
+    node.parent = parent;
+    node.nameLength = static_cast<uint16_t>(name.size());
+    metadataBlock[index & ((1u << nodeBlockBits) - 1)] = metadata;
+    pendingBlock[index & ((1u << nodeBlockBits) - 1)].store(1, memory_order_relaxed);
+
+    // The parent cannot be finished before the new child is
+    if (parent != NoNode) {
+        GetPending(parent)++;
+    }
+
+    // Publish the node only after it is completely written
+    nodeCount.store(index + 1, memory_order_release);
+    return index;
+}
+
+uint64_t PathTable::Intern(wstring_view name)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (wchar_t c : name) {
+        hash = (hash ^ static_cast<uint32_t>(c)) * 16777619u;
+    }
+
+    size_t mask = internSlots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        InternSlot& slot = internSlots[i];
+        if (!slot.used) {
+            slot = { StoreName(name), hash, static_cast<uint16_t>(name.size()), true };
+            if (++internCount * 2 > internSlots.size()) {
+                uint64_t offset = slot.nameOffset;
+                GrowInternSlots();
+                return offset;
+            }
+            return slot.nameOffset;
+        }
+
+        if (slot.hash == hash && slot.nameLength == name.size()) {
+            if (wmemcmp(GetName(slot.nameOffset), name.data(), name.size()) == 0) {
+                return slot.nameOffset;
+            }
+        }
+    }
+}
+
+uint64_t PathTable::StoreName(wstring_view name)
+{
+    constexpr uint64_t chunkSize = uint64_t(1) << nameChunkBits;
+
+    // A name never spans two chunks
+    if ((nameUsed & (chunkSize - 1)) + name.size() > chunkSize) {
+        nameUsed = (nameUsed + chunkSize) & ~(chunkSize - 1);
+    }
+
+    unique_ptr<wchar_t[]>& chunk = nameChunks[nameUsed >> nameChunkBits];
+    if (!chunk) {
+        chunk = make_unique<wchar_t[]>(chunkSize);
+    }
+
+    size_t previousChunk = currentChunk;
+    currentChunk = static_cast<size_t>(nameUsed >> nameChunkBits);
+    if (reclaim && previousChunk != currentChunk) {
+        FreeChunkLocked(previousChunk);
+    }
+
+    uint64_t offset = nameUsed;
+    wmemcpy(chunk.get() + (offset & (chunkSize - 1)), name.data(), name.size());
+    nameUsed += name.size();
+    return offset;
+}
+
+void PathTable::GrowInternSlots()
+{
+    vector<InternSlot> grown(internSlots.size() * 2);
+    size_t mask = grown.size() - 1;
+    for (const InternSlot& slot : internSlots) {
+        if (!slot.used) {
+            continue;
+        }
+
+        size_t i = slot.hash & mask;
+        while (grown[i].used) {
+            i = (i + 1) & mask;
+        }
+        grown[i] = slot;
+    }
+    internSlots.swap(grown);
+}
+
+void PathTable::GetLongPath(Handle node, wstring& buffer) const
+{
+    GetPath(node, buffer);
+    ToLongPath(buffer);
+}
+
+// Directories are limited to MAX_PATH - 12, so a file name of 8.3 still fits in them.
+// Prefixed paths are not normalized any more, which the paths of the scan never need.
+void PathTable::ToLongPath(wstring& path)
+{
+    if (path.size() < MAX_PATH - 12 || path.compare(0, 4, L"\\\\?\\") == 0) {
+        return;
+    }
+
+    if (path.size() >= 3 && path[1] == L':' && path[2] == L'\\') {
+        path.insert(0, L"\\\\?\\");
+    }
+    else if (path.compare(0, 2, L"\\\\") == 0 && path[2] != L'.') {
+        path.replace(0, 2, L"\\\\?\\UNC\\");
+    }
+}
+
+void PathTable::GetPath(Handle node, wstring& buffer) const
+{
+    buffer.clear();
+    if (node == NoNode) {
+        return;
+    }
+
+    // First walk measures, the second one fills the buffer from the back
+    size_t length = 0;
+    for (Handle current = node; current != NoNode;) {
+        const Node& entry = GetNode(current);
+        length += entry.nameLength;
+        if (entry.parent != NoNode) {
+            const Node& parent = GetNode(entry.parent);
+            if (parent.nameLength == 0 || GetName(parent.nameOffset)[parent.nameLength - 1] != L'\\') {
+                length++;
+            }
+        }
+        current = entry.parent;
+    }
+
+    buffer.resize(length);
+    size_t position = length;
+    for (Handle current = node; current != NoNode;) {
+        const Node& entry = GetNode(current);
+        position -= entry.nameLength;
+        wmemcpy(&buffer[position], GetName(entry.nameOffset), entry.nameLength);
+        if (entry.parent != NoNode) {
+            const Node& parent = GetNode(entry.parent);
+            if (parent.nameLength == 0 || GetName(parent.nameOffset)[parent.nameLength - 1] != L'\\') {
+                buffer[--position] = L'\\';
+            }
+        }
+        current = entry.parent;
+    }
+}
+
+wstring PathTable::GetPath(Handle node) const
+{
+    wstring path;
+    GetPath(node, path);
+    return path;
+}
+
+wstring PathTable::GetDisplayPath(Handle node) const
+{
+    // Blocks and chunks are only freed under the lock
+    lock_guard<mutex> lock(addMutex);
+    for (Handle current = node; current != NoNode; current = GetNode(current).parent) {
+        if (!nodeBlocks[current >> nodeBlockBits] || !nameChunks[GetNode(current).nameOffset >> nameChunkBits]) {
+            return wstring();
+        }
+    }
+    return GetPath(node);
+}
+
+void PathTable::Retire(Handle node)
+{
+    if (!reclaim) {
+        return;
+    }
+
+    size_t chunk = static_cast<size_t>(GetNode(node).nameOffset >> nameChunkBits);
+    size_t block = node >> nodeBlockBits;
+    bool chunkDone = liveNames[chunk].fetch_sub(1) == 1;
+    bool blockDone = liveNodes[block].fetch_sub(1) == 1;
+    if (chunkDone || blockDone) {
+        lock_guard<mutex> lock(addMutex);
+        if (chunkDone) {
+            FreeChunkLocked(chunk);
+        }
+        if (blockDone) {
+            FreeBlockLocked(block);
+        }
+    }
+}
+
+// The block nodes are added to right now stays, AddLocked frees it once it moves on
+void PathTable::FreeBlockLocked(size_t block)
+{
+    if (liveNodes[block] != 0 || block == (nodeCount.load(memory_order_relaxed) >> nodeBlockBits)) {
+        return;
+    }
+    nodeBlocks[block].reset();
+    metadataBlocks[block].reset();
+    pendingBlocks[block].reset();
+}
+
+// Likewise the chunk names are stored in right now
+void PathTable::FreeChunkLocked(size_t chunk)
+{
+    if (liveNames[chunk] != 0 || chunk == currentChunk) {
+        return;
+    }
+    nameChunks[chunk].reset();
+}
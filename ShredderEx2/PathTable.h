@@ -0,0 +1,178 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+// What the directory listing already told us about an entry. The delete path works
+// from this record instead of asking the file system again for every file.
+struct EntryMetadata {
+    uint64_t size = 0;
+    uint64_t fileId = 0;
+    DWORD attributes = INVALID_FILE_ATTRIBUTES;
+    DWORD reparseTag = 0;
+
+    bool IsDirectory() const {
+        return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+    }
+
+    // Junctions and symbolic links, to directories or files. Other reparse points, e.g.
+    // cloud file placeholders or deduplicated files, are ordinary entries.
+    bool IsLink() const {
+        return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_REPARSE_POINT) && IsReparseTagNameSurrogate(reparseTag);
+    }
+};
+
+// Tree-shaped path store. Every node keeps the handle of its parent and its leaf name.
+// Names are interned and packed into large UTF-16 chunks, so memory follows the sum of
+// the name lengths instead of the sum of the full path lengths. Full paths are rebuilt
+// on demand into a buffer supplied by the caller.
+// Adding is thread-safe. Nodes and names never move, so a handle that was passed to
+// another thread can be read there without locking.
+// With reclaiming on, finished nodes are retired. Names are then stored per node instead
+// of interned, and a block of nodes or a chunk of names is freed once everything in it
+// is retired, so memory follows the entries that are still open and not the whole tree.
+// Handles are never reused.
+class PathTable {
+public:
+    using Handle = uint32_t;
+    static constexpr Handle NoNode = UINT32_MAX;
+
+    struct NewChild {
+        wstring_view name;
+        EntryMetadata metadata;
+    };
+
+private:
+    struct Node {
+        uint64_t nameOffset;
+        Handle parent;
+        uint16_t nameLength;
+    };
+
+    struct InternSlot {
+        uint64_t nameOffset;
+        uint32_t hash;
+        uint16_t nameLength;
+        bool used;
+    };
+
+    static constexpr int nodeBlockBits = 16;
+    static constexpr size_t maxNodeBlocks = size_t(1) << 16;
+    static constexpr int nameChunkBits = 20;
+    static constexpr size_t maxNameChunks = size_t(1) << 16;
+
+    unique_ptr<unique_ptr<Node[]>[]> nodeBlocks;
+    unique_ptr<unique_ptr<EntryMetadata[]>[]> metadataBlocks;
+    unique_ptr<unique_ptr<atomic<uint32_t>[]>[]> pendingBlocks;
+    unique_ptr<unique_ptr<wchar_t[]>[]> nameChunks;
+    atomic<uint32_t> nodeCount{ 0 };
+    uint64_t nameUsed = 0;
+    vector<InternSlot> internSlots;
+    size_t internCount = 0;
+    vector<Handle> order;
+    // Also taken to free blocks and chunks, and by GetDisplayPath
+    mutable mutex addMutex;
+
+    // Nodes and names not retired yet, per block and chunk. Only kept when reclaiming.
+    bool reclaim = false;
+    unique_ptr<atomic<uint32_t>[]> liveNodes;
+    unique_ptr<atomic<uint32_t>[]> liveNames;
+    size_t currentChunk = 0;
+
+    const Node& GetNode(Handle node) const {
+        return nodeBlocks[node >> nodeBlockBits][node & ((1u << nodeBlockBits) - 1)];
+    }
+
+    atomic<uint32_t>& GetPending(Handle node) {
+        return pendingBlocks[node >> nodeBlockBits][node & ((1u << nodeBlockBits) - 1)];
+    }
+
+    const wchar_t* GetName(uint64_t nameOffset) const {
+        return nameChunks[nameOffset >> nameChunkBits].get() + (nameOffset & ((uint64_t(1) << nameChunkBits) - 1));
+    }
+
+    Handle AddLocked(Handle parent, wstring_view name, const EntryMetadata& metadata);
+    uint64_t Intern(wstring_view name);
+    uint64_t StoreName(wstring_view name);
+    void GrowInternSlots();
+    void FreeBlockLocked(size_t block);
+    void FreeChunkLocked(size_t chunk);
+
+public:
+    PathTable();
+    PathTable(const PathTable&) = delete;
+    PathTable& operator=(const PathTable&) = delete;
+
+    // A root carries its whole path as its name, e.g. "C:\Users\me\Downloads"
+    Handle AddRoot(wstring_view path, const EntryMetadata& metadata);
+    Handle AddChild(Handle parent, wstring_view name, const EntryMetadata& metadata);
+    // Adds all children under one lock, they get consecutive handles. Returns the first one.
+    Handle AddChildren(Handle parent, const NewChild* children, size_t count);
+
+    void GetPath(Handle node, wstring& buffer) const;
+    wstring GetPath(Handle node) const;
+    // GetPath for opening: a path too long for the Win32 path parser gets the \\?\ prefix
+    void GetLongPath(Handle node, wstring& buffer) const;
+
+    // Adds the \\?\ or \\?\UNC\ prefix to an absolute path that would exceed MAX_PATH
+    static void ToLongPath(wstring& path);
+
+    // GetPath for a handle that may have been retired meanwhile, e.g. the one the UI
+    // shows. Empty if its memory is gone.
+    wstring GetDisplayPath(Handle node) const;
+
+    // Not thread-safe, call before the first node is added
+    void EnableReclaim();
+
+    // Gives back a node that nobody uses any more. Its handle must not be read after
+    // this, except through GetDisplayPath. Thread-safe, does nothing without reclaiming.
+    void Retire(Handle node);
+
+    const EntryMetadata& GetMetadata(Handle node) const {
+        return metadataBlocks[node >> nodeBlockBits][node & ((1u << nodeBlockBits) - 1)];
+    }
+
+    bool IsDirectory(Handle node) const {
+        return GetMetadata(node).IsDirectory();
+    }
+
+    Handle GetParent(Handle node) const {
+        return GetNode(node).parent;
+    }
+
+    wstring_view GetLeafName(Handle node) const {
+        const Node& entry = GetNode(node);
+        return wstring_view(GetName(entry.nameOffset), entry.nameLength);
+    }
+
+    // Every node starts with one pending reference for itself, and every child added
+    // below it adds one. Drops one of node and returns true if it was the last, then
+    // everything below node is finished. Thread-safe.
+    bool Release(Handle node) {
+        return GetPending(node).fetch_sub(1) == 1;
+    }
+
+    size_t NodeCount() const {
+        return nodeCount;
+    }
+
+    // Processing order: children before their parent directory. Not thread-safe.
+    void Emit(Handle node) {
+        order.push_back(node);
+    }
+
+    size_t Size() const {
+        return order.size();
+    }
+
+    Handle At(size_t index) const {
+        return order[index];
+    }
+};
@@ -0,0 +1,22 @@
+#include "Privilege.h"
+
+#pragma comment(lib, "advapi32.lib")
+
+bool Privilege::Enable(LPCWSTR name)
+{
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return false;
+    }
+
+    // AdjustTokenPrivileges also succeeds for privileges the account does not hold, only
+    // the last error tells
+    TOKEN_PRIVILEGES privileges = {};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    bool enabled = LookupPrivilegeValue(nullptr, name, &privileges.Privileges[0].Luid)
+        && AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+        && GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return enabled;
+}
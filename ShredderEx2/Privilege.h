@@ -0,0 +1,10 @@
+#pragma once
+#include <Windows.h>
+
+// Privileges that administrators hold but that are disabled in their token by default
+class Privilege {
+public:
+    // Enables the privilege in the process token, e.g. SE_MANAGE_VOLUME_NAME. False if
+    // the account does not hold it.
+    static bool Enable(LPCWSTR name);
+};
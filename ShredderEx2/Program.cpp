@@ -35,6 +35,7 @@
 #include "imgui/imgui_internal.h"
 #include <future>
 #include "FileManagement.h"
+#include "ShredOptions.h"
 #include "resource.h"
 
 template<typename T1, typename T2, typename T3, typename T4>
@@ -78,6 +79,7 @@ static D3D12_CPU_DESCRIPTOR_HANDLE  g_mainRenderTargetDescriptor[NUM_BACK_BUFFER
 LPWSTR* argv;
 
 // Forward declarations of helper functions
+void ParseCommandLine(int argc, LPWSTR* argv, ShredOptions& options, vector<wstring>& targets);
 wstring ImGuiTruncateTextMiddle(const std::wstring& text, float maxWidth);
 void ImGuiPushDisableItem(bool toggle);
 void ImGuiPopDisableItem(bool toggle);
@@ -98,14 +100,17 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         int argc;
         argv = CommandLineToArgvW(GetCommandLineW(), &argc);
 
-        wstring selectedPath = L"";
+        ShredOptions options;
+        vector<wstring> targets;
+        ParseCommandLine(argc, argv, options, targets);
 
-        if (argc <= 1) {
-            selectedPath = OpenFileOrFolderDialog(NULL);
+        if (targets.empty()) {
+            wstring selectedPath = OpenFileOrFolderDialog(NULL);
             if (selectedPath.empty()) {
                 MessageBox(NULL, L"Please specify at least one file or folder.", L"ShredderEx2", MB_OK | MB_ICONERROR);
                 exit(0);
             }
+            targets.push_back(selectedPath);
 		}
 
         // Create application window
@@ -132,7 +137,7 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
         // Window size and controls
         SetWindowLongPtr(hwnd, GWL_STYLE, GetWindowLongPtr(hwnd, GWL_STYLE) & ~WS_SYSMENU);
-        ImVec2 windowFullSize = ImVec2(550, 260);
+        ImVec2 windowFullSize = ImVec2(550, 305);
         SetWindowPos(hwnd, NULL, 200, 200, static_cast<int>(windowFullSize.x), static_cast<int>(windowFullSize.y), 0);
         LONG style = GetWindowLong(hwnd, GWL_STYLE);
         style &= ~WS_MAXIMIZEBOX;
@@ -192,37 +197,31 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
         atomic<bool> cancelFutureTasks(false);
         FileManagement fileManagement;
-        vector<vector<wstring>> filesAndFolders;
+        fileManagement.SetOptions(options);
         size_t totalCount = 0;
         future<void> findFilesAndFolders = async(launch::async, [&] {
+            // Streaming mode scans while shredding and the free space wipe does not scan,
+            // there is nothing to prepare
+            if (options.streaming || options.wipeFreeSpace) {
+                return;
+            }
+
             // Get all paths and subpaths
-            if (argc > 1) {
-                for (int i = 1; i < argc; i++) {
-                    if (fileManagement.IsFile(argv[i])) {
-                        vector<wstring> simpleFile = { argv[i] };
-                        filesAndFolders.push_back(simpleFile);
-                    }
-                    else {
-                        filesAndFolders.push_back(fileManagement.GetAllNeededPaths(argv[i], &cancelFutureTasks));
-                        filesAndFolders.push_back({ argv[i] });
-                    }
+            PathTable& filesAndFolders = fileManagement.GetPaths();
+            for (const wstring& target : targets) {
+                PathTable::Handle root = fileManagement.AddRoot(target);
+                if (root == PathTable::NoNode) {
+                    continue;
                 }
-            }
-            else {
-                if (fileManagement.IsFile(selectedPath)) {
-					vector<wstring> simpleFile = { selectedPath };
-					filesAndFolders.push_back(simpleFile);
-				}
-                else {
-					filesAndFolders.push_back(fileManagement.GetAllNeededPaths(selectedPath, &cancelFutureTasks));
-                    filesAndFolders.push_back({ selectedPath });
-				}
-            }
 
-            // Count inner vectors -> Useful for the progressbar -> totalCount = 100 %
-            for (const auto& innerVec : filesAndFolders) {
-                totalCount += innerVec.size();
+                if (filesAndFolders.IsDirectory(root)) {
+                    fileManagement.GetAllNeededPaths(root, &cancelFutureTasks);
+                }
+                filesAndFolders.Emit(root);
             }
+
+            // Useful for the progressbar -> totalCount = 100 %
+            totalCount = filesAndFolders.Size();
         });
 
         // Main loop
@@ -233,12 +232,53 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         bool alreadyEnabledOnes = false;
         bool startedDeleting = false;
         wstring closeBtnText = L"Cancel";
+        // Write throughput, measured over the last second
+        ULONGLONG throughputTick = GetTickCount64();
+        uint64_t throughputBytes = 0;
+        uint64_t throughputWrites = 0;
+        char throughputText[64] = "";
+        // Lines of the tooltips that list problem files
+        const size_t maxListedFiles = 20;
+        // Throttle sliders, they start at the limits from the command line
+        int maxRateSlider = static_cast<int>(options.maxBytesPerSecond >> 20);
+        int maxOpsSlider = static_cast<int>(options.maxOpsPerSecond);
         while (!done) {
             if (findFilesAndFolders.wait_for(chrono::seconds(0)) == future_status::ready && !alreadyEnabledOnes) {
                 marqueeFileSearchSpeed = 0.f;
                 enableStartBtn = true;
                 alreadyEnabledOnes = true;
-                fileManagement.SetLatestScanFile(L"");
+                fileManagement.SetLatestScanFile(PathTable::NoNode);
+            }
+
+            if (options.streaming && startedDeleting) {
+                // The scan runs alongside the shredding, so the total keeps growing until it is done
+                marqueeFileSearchSpeed = fileManagement.GetScanning() ? 1.f : 0.f;
+                totalCount = fileManagement.GetScannedCount();
+            }
+
+            if (options.wipeFreeSpace && startedDeleting) {
+                totalCount = fileManagement.GetWipeTotal();
+            }
+
+            if (startedDeleting && GetTickCount64() - throughputTick >= 1'000) {
+                const OverwriteEngine& engine = fileManagement.GetOverwriteEngine();
+                double seconds = (GetTickCount64() - throughputTick) / 1000.0;
+                uint64_t bytes = engine.GetBytesWritten();
+                uint64_t writes = engine.GetWritesCompleted();
+                snprintf(throughputText, sizeof(throughputText), "%.1f MB/s  %.0f IOPS",
+                    (bytes - throughputBytes) / seconds / (1024 * 1024), (writes - throughputWrites) / seconds);
+
+                // What the batched flushes cost, over the whole job
+                const DurabilityBarrier& durability = engine.GetDurability();
+                uint64_t flushes = durability.GetFlushCount();
+                if (flushes > 0) {
+                    size_t used = strlen(throughputText);
+                    snprintf(throughputText + used, sizeof(throughputText) - used, "  %.1f files %.1f ms/flush",
+                        static_cast<double>(durability.GetCommitCount()) / flushes, durability.GetFlushMicroseconds() / 1000.0 / flushes);
+                }
+                throughputTick = GetTickCount64();
+                throughputBytes = bytes;
+                throughputWrites = writes;
             }
 
             bool isFindFilesAndFoldersReady = !findFilesAndFolders.valid() ||
@@ -295,31 +335,102 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
                     ImGui::Dummy(ImVec2(0, style.WindowPadding.y));
 
                     float progressRatio = static_cast<float>(fileManagement.GetProgress()) / static_cast<float>(totalCount);
-                    ImGui::ProgressBar((totalCount > 0) ? fileManagement.GetProgress() <= totalCount ? progressRatio : 100.f : 0.0f, ImVec2(windowSize.x - style.WindowPadding.x * 3 - 75, 33));
+                    float progressFraction = (totalCount > 0) ? fileManagement.GetProgress() <= totalCount ? progressRatio : 100.f : 0.0f;
+                    char progressText[128];
+                    snprintf(progressText, sizeof(progressText), throughputText[0] ? "%.0f%%  %s" : "%.0f%%", min(progressFraction, 1.f) * 100, throughputText);
+                    uint64_t mismatchCount = fileManagement.GetOverwriteEngine().GetMismatchCount();
+                    if (mismatchCount > 0) {
+                        size_t used = strlen(progressText);
+                        snprintf(progressText + used, sizeof(progressText) - used, "  %llu verify errors", static_cast<unsigned long long>(mismatchCount));
+                    }
+                    size_t failedCount = fileManagement.GetFailedCount();
+                    if (failedCount > 0) {
+                        size_t used = strlen(progressText);
+                        snprintf(progressText + used, sizeof(progressText) - used, "  %zu failed", failedCount);
+                    }
+                    size_t lockedCount = fileManagement.GetLockedCount();
+                    if (lockedCount > 0) {
+                        size_t used = strlen(progressText);
+                        snprintf(progressText + used, sizeof(progressText) - used, "  %zu locked", lockedCount);
+                    }
+                    ImGui::ProgressBar(progressFraction, ImVec2(windowSize.x - style.WindowPadding.x * 3 - 75, 33), progressText);
+                    // Figures of the job, then the files behind the counts, they stay where they are
+                    if ((startedDeleting || failedCount > 0 || mismatchCount > 0) && ImGui::IsItemHovered()) {
+                        ImGui::BeginTooltip();
+                        if (startedDeleting) {
+                            // The allocations stop growing once the pool covers the workers
+                            const BufferPool& bufferPool = fileManagement.GetOverwriteEngine().GetBufferPool();
+                            ImGui::Text("Write buffers: %zu%s, %llu allocations for %llu borrows", bufferPool.GetBufferCount(), bufferPool.UsesLargePages() ? " on large pages" : "",
+                                static_cast<unsigned long long>(bufferPool.GetAllocationCount()), static_cast<unsigned long long>(bufferPool.GetBorrowCount()));
+                            if (options.trim) {
+                                ImGui::Text("Trimmed: %.1f MB", fileManagement.GetOverwriteEngine().GetBytesTrimmed() / (1024.0 * 1024.0));
+                            }
+                        }
+                        if (failedCount > 0) {
+                            ImGui::Text("Not shredded, kept:");
+                            vector<wstring> failedFiles = fileManagement.GetFailedFiles();
+                            for (size_t i = 0; i < failedFiles.size() && i < maxListedFiles; i++) {
+                                ImGui::TextUnformatted(ImGuiWString(failedFiles[i]));
+                            }
+                            if (failedFiles.size() > maxListedFiles) {
+                                ImGui::Text("and %zu more", failedFiles.size() - maxListedFiles);
+                            }
+                        }
+                        // The ranges that read back different, by byte offset in the file
+                        if (mismatchCount > 0) {
+                            ImGui::Text("Verify errors:");
+                            vector<OverwriteEngine::Mismatch> mismatches = fileManagement.GetOverwriteEngine().GetMismatches();
+                            for (size_t i = 0; i < mismatches.size() && i < maxListedFiles; i++) {
+                                char range[64];
+                                snprintf(range, sizeof(range), "  %llu +%llu bytes", static_cast<unsigned long long>(mismatches[i].offset), static_cast<unsigned long long>(mismatches[i].length));
+                                ImGui::TextUnformatted((ImGuiWString(mismatches[i].path) + string(range)).c_str());
+                            }
+                            if (mismatchCount > min(mismatches.size(), maxListedFiles)) {
+                                ImGui::Text("and %llu more", static_cast<unsigned long long>(mismatchCount - min(mismatches.size(), maxListedFiles)));
+                            }
+                        }
+                        ImGui::EndTooltip();
+                    }
                     ImGui::SameLine(0, style.WindowPadding.x);
                     ImGuiPushDisableItem(!enableStartBtn);
                         if (ImGui::Button("Start", ImVec2(75, 33))) {
                             enableStartBtn = false;
                             startedDeleting = true;
 
-                            vector<wstring> combined;
-
-                            for (const auto& folder : filesAndFolders) {
-                                combined.insert(combined.end(), folder.begin(), folder.end());
+                            if (options.wipeFreeSpace) {
+                                fileManagement.WipeFreeSpace(targets);
+                            }
+                            else if (options.streaming) {
+                                fileManagement.DeleteStreaming(targets);
+                            }
+                            else {
+                                fileManagement.Delete();
                             }
-
-                            fileManagement.Delete(combined);
                         }
                     ImGuiPopDisableItem(!enableStartBtn);
                     ImGui::Text(ImGuiWString(ImGuiTruncateTextMiddle(fileManagement.GetLatestDeleteFile(), windowSize.x - style.WindowPadding.x * 2)));
                     ImGui::Dummy(ImVec2(0, style.WindowPadding.y));
+
+                    // Take effect right away, also while the job runs
+                    float sliderWidth = (windowSize.x - style.WindowPadding.x * 3) / 2;
+                    ImGui::SetNextItemWidth(sliderWidth);
+                    if (ImGui::SliderInt("##MaxRate", &maxRateSlider, 0, 4000, maxRateSlider == 0 ? "Unlimited MB/s" : "Max %d MB/s", ImGuiSliderFlags_Logarithmic)) {
+                        fileManagement.SetMaxRate(static_cast<uint64_t>(maxRateSlider) * 1024 * 1024);
+                    }
+                    ImGui::SameLine(0, style.WindowPadding.x);
+                    ImGui::SetNextItemWidth(sliderWidth);
+                    if (ImGui::SliderInt("##MaxOps", &maxOpsSlider, 0, 100000, maxOpsSlider == 0 ? "Unlimited files/s" : "Max %d files/s", ImGuiSliderFlags_Logarithmic)) {
+                        fileManagement.SetMaxOps(static_cast<uint64_t>(maxOpsSlider));
+                    }
+                    ImGui::Dummy(ImVec2(0, style.WindowPadding.y));
                     if (ImGui::Button(ImGuiWString(closeBtnText), ImVec2(75, 33)))
                     {
                         done = true;
                         cancelFutureTasks = true;
                         fileManagement.SetDeleteFutureCancellation(true);
                     }
-                    ImGuiPushDisableItem(fileManagement.GetDone() || !(fileManagement.GetBreakpoint() && !fileManagement.GetRemember()));
+                    // Decides for all locked files collected so far, the job goes on meanwhile
+                    ImGuiPushDisableItem(fileManagement.GetDone() || !(fileManagement.GetLockedCount() > 0 && !fileManagement.GetRemember()));
                         float btnSize = ImGui::GetItemRectSize().y;
                         ImGui::SameLine(0, windowSize.x - (75 * 3 + style.WindowPadding.x * 5 + (/*Checkbox*/style.FramePadding.y * 2 + style.ItemInnerSpacing.x + ImGui::CalcTextSize("Remember Choice").x + 3)));
                         float currentPosY = ImGui::GetCursorPosY();
@@ -336,7 +447,7 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
                             fileManagement.SetRemember(rememberCheckbox);
 							fileManagement.SetAction(FileManagement::FileAction::Kill);
                         }
-                    ImGuiPopDisableItem(fileManagement.GetDone() || !(fileManagement.GetBreakpoint() && !fileManagement.GetRemember()));
+                    ImGuiPopDisableItem(fileManagement.GetDone() || !(fileManagement.GetLockedCount() > 0 && !fileManagement.GetRemember()));
                 ImGui::PopStyleColor(8);
                 ImGui::End();
             ImGui::PopStyleColor();
@@ -400,6 +511,127 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
 // Helper functions
 
+// Splits the arguments into paths to shred and "--name=value" switches
+void ParseCommandLine(int argc, LPWSTR* argv, ShredOptions& options, vector<wstring>& targets)
+{
+    for (int i = 1; i < argc; i++) {
+        wstring arg = argv[i];
+        if (!arg.starts_with(L"--")) {
+            targets.push_back(arg);
+            continue;
+        }
+
+        size_t separator = arg.find(L'=');
+        wstring name = arg.substr(2, separator == wstring::npos ? wstring::npos : separator - 2);
+        wstring value = separator == wstring::npos ? L"" : arg.substr(separator + 1);
+        unsigned long number = wcstoul(value.c_str(), nullptr, 10);
+
+        if (name == L"stream") {
+            options.streaming = true;
+        }
+        else if (name == L"stream-queue") {
+            options.streamQueueCapacity = number;
+        }
+        else if (name == L"delete-workers") {
+            options.deleteWorkers = number;
+        }
+        else if (name == L"large-lanes") {
+            options.largeFileLanes = number;
+        }
+        else if (name == L"large-file") {
+            options.largeFileSize = static_cast<uint64_t>(number) * 1024 * 1024;
+        }
+        else if (name == L"scan-workers") {
+            options.scanWorkers = number;
+        }
+        else if (name == L"listing") {
+            if (value == L"find") {
+                options.listing = ListingBackend::FindFirstFile;
+            }
+            else if (value == L"both") {
+                options.listing = ListingBackend::FileIdBoth;
+            }
+            else if (value == L"extd") {
+                options.listing = ListingBackend::FileIdExtd;
+            }
+        }
+        else if (name == L"links") {
+            if (value == L"skip") {
+                options.links = ReparsePolicy::DontFollow;
+            }
+            else if (value == L"once") {
+                options.links = ReparsePolicy::FollowOnce;
+            }
+            else if (value == L"visited") {
+                options.links = ReparsePolicy::FollowVisited;
+            }
+        }
+        else if (name == L"scheme") {
+            if (value == L"zeros") {
+                options.scheme = OverwriteScheme::Zeros;
+            }
+            else if (value == L"dod") {
+                options.scheme = OverwriteScheme::DoD;
+            }
+            else if (value == L"random") {
+                options.scheme = OverwriteScheme::Random;
+            }
+            else if (value == L"gutmann") {
+                options.scheme = OverwriteScheme::Gutmann;
+            }
+        }
+        else if (name == L"delete") {
+            if (value == L"path") {
+                options.deleteBackend = DeleteBackend::Path;
+            }
+            else if (value == L"relative") {
+                options.deleteBackend = DeleteBackend::Relative;
+            }
+        }
+        else if (name == L"verify") {
+            options.verify = true;
+        }
+        else if (name == L"queue-depth") {
+            options.queueDepth = number;
+        }
+        else if (name == L"block-size") {
+            options.writeBlockSize = static_cast<size_t>(number) * 1024;
+        }
+        else if (name == L"durability") {
+            if (value == L"write-through") {
+                options.durability = DurabilityMode::WriteThrough;
+            }
+            else if (value == L"batch") {
+                options.durability = DurabilityMode::Batched;
+            }
+            else if (value == L"none") {
+                options.durability = DurabilityMode::None;
+            }
+        }
+        else if (name == L"max-ops") {
+            options.maxOpsPerSecond = number;
+        }
+        else if (name == L"background") {
+            options.backgroundIo = true;
+        }
+        else if (name == L"trim") {
+            options.trim = true;
+        }
+        else if (name == L"large-pages") {
+            options.largePages = true;
+        }
+        else if (name == L"max-rate") {
+            options.maxBytesPerSecond = static_cast<uint64_t>(number) * 1024 * 1024;
+        }
+        else if (name == L"wipe-free") {
+            options.wipeFreeSpace = true;
+        }
+        else if (name == L"scrub-names") {
+            options.scrubNames = true;
+        }
+    }
+}
+
 wstring ImGuiTruncateTextMiddle(const wstring& text, float maxWidth) {
     float padding = 10.0f;
     maxWidth -= padding;
@@ -0,0 +1,40 @@
+#include "RateLimiter.h"
+#include <algorithm>
+#include <chrono>
+
+void RateLimiter::SetRate(uint64_t unitsPerSecond)
+{
+    lock_guard<mutex> guard(lock);
+    rate = unitsPerSecond;
+    tokens = 0;
+    lastRefill = GetTickCount64();
+    changed.notify_all();
+}
+
+void RateLimiter::Acquire(uint64_t units)
+{
+    unique_lock<mutex> guard(lock);
+    for (;;) {
+        uint64_t currentRate = rate;
+        if (currentRate == 0 || IsCancelled()) {
+            return;
+        }
+
+        ULONGLONG now = GetTickCount64();
+        tokens += (now - lastRefill) / 1000.0 * currentRate;
+        if (tokens > static_cast<double>(currentRate)) {
+            tokens = static_cast<double>(currentRate);
+        }
+        lastRefill = now;
+
+        double needed = static_cast<double>(min(units, currentRate));
+        if (tokens >= needed) {
+            tokens -= static_cast<double>(units);
+            return;
+        }
+
+        // Only as long as this request needs, the others are woken by their own timeouts
+        DWORD wait = static_cast<DWORD>((needed - tokens) * 1000.0 / currentRate) + 1;
+        changed.wait_for(guard, chrono::milliseconds(min(wait, pollInterval)));
+    }
+}
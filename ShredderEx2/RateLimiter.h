@@ -0,0 +1,48 @@
+#pragma once
+#include <Windows.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+// Token bucket over bytes or operations, shared by all threads that do I/O. The bucket
+// refills at the rate and holds at most a burst of one second. A caller waits until the
+// bucket holds its request, or a full burst for a request larger than that, which then
+// goes into debt by the rest. Waiting callers look again when the rate changes and at
+// least every pollInterval, so a new rate or a cancellation takes effect right away
+// instead of after a debt is slept off. Thread-safe.
+class RateLimiter {
+private:
+    // The cancellation flag does not notify
+    static constexpr DWORD pollInterval = 50;
+
+    atomic<uint64_t> rate{ 0 };
+    double tokens = 0;
+    ULONGLONG lastRefill = 0;
+    atomic<bool>* cancellation = nullptr;
+    mutex lock;
+    condition_variable changed;
+
+    bool IsCancelled() const {
+        return cancellation && *cancellation;
+    }
+
+public:
+    // Bytes or operations per second, 0 = unlimited. Can be changed while other threads
+    // acquire, waiting ones go on with the new rate.
+    void SetRate(uint64_t unitsPerSecond);
+
+    uint64_t GetRate() const {
+        return rate;
+    }
+
+    // Acquire returns without waiting once value is set
+    void SetCancellation(atomic<bool>* value) {
+        cancellation = value;
+    }
+
+    // Blocks until units may be used
+    void Acquire(uint64_t units);
+};
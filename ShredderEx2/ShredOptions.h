@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// How the scan reads directories (--listing=find|both|extd)
+enum class ListingBackend {
+    // FindFirstFileEx with FindExInfoBasic and FIND_FIRST_EX_LARGE_FETCH, no file IDs
+    FindFirstFile,
+    // GetFileInformationByHandleEx(FileIdBothDirectoryInfo), works on every NTFS/FAT volume
+    FileIdBoth,
+    // GetFileInformationByHandleEx(FileIdExtdDirectoryInfo), falls back to FileIdBoth
+    // where the file system does not support it
+    FileIdExtd
+};
+
+// What happens to the targets of junctions and symbolic links (--links=skip|once|visited).
+// The link itself is always removed. A followed directory link is scanned like a
+// directory of the selection, a followed file link has its target shredded and deleted.
+enum class ReparsePolicy {
+    // Never follow a link, its target stays untouched
+    DontFollow,
+    // Follow links, but not the links found behind a directory link. Like with
+    // FollowVisited, a target that was scanned already is not scanned again.
+    FollowOnce,
+    // Enter every link whose target directory has not been scanned yet. Links are entered
+    // after everything reachable without them, so a target inside the selection is never
+    // scanned twice and link loops end. File links are followed as with FollowOnce.
+    FollowVisited
+};
+
+// What is written over a file before it is deleted (--scheme=zeros|dod|random|gutmann)
+enum class OverwriteScheme {
+    // One pass of zeros
+    Zeros,
+    // DoD 5220.22-M, 3 passes: zeros, ones, random
+    DoD,
+    // One pass of random data
+    Random,
+    // Gutmann, 35 passes
+    Gutmann
+};
+
+// How entries are deleted when the overwrite did not already delete them (--delete=path|relative)
+enum class DeleteBackend {
+    // DeleteFile and RemoveDirectory, which resolve the whole path every time
+    Path,
+    // NtOpenFile with only the name, relative to a handle of the parent directory that
+    // every worker keeps open, and a POSIX delete through that handle
+    Relative
+};
+
+// How the overwritten data is made durable before a file is deleted
+// (--durability=write-through|batch|none)
+enum class DurabilityMode {
+    // Every write goes through to the disk before it completes
+    WriteThrough,
+    // Writes may stay in the disk cache. Workers that finish files at the same time wait
+    // for one flush of the whole volume, or flush their file if the volume cannot be opened.
+    Batched,
+    // Writes may stay in the disk cache, only the system cache of buffered handles is flushed
+    None
+};
+
+// Settings of a shredding job, filled from the "--" switches on the command line
+struct ShredOptions {
+    // Start shredding while the scan is still running (--stream)
+    bool streaming = false;
+    // Scanned files of each size class that may wait for a delete worker in streaming mode (--stream-queue=N)
+    size_t streamQueueCapacity = 4096;
+    // Parallel delete workers for the small files (--delete-workers=N)
+    unsigned int deleteWorkers = 8;
+    // Delete workers that stream the large files (--large-lanes=N)
+    unsigned int largeFileLanes = 2;
+    // Files from this size on go to the large file lanes (--large-file=N in MB)
+    uint64_t largeFileSize = 64 * 1024 * 1024;
+    // Directory scan workers, 0 = one per CPU core (--scan-workers=N)
+    unsigned int scanWorkers = 0;
+    ListingBackend listing = ListingBackend::FileIdExtd;
+    // A link may lead out of the selection, e.g. to the root of a volume, so following
+    // is opt-in
+    ReparsePolicy links = ReparsePolicy::DontFollow;
+    OverwriteScheme scheme = OverwriteScheme::Zeros;
+    DeleteBackend deleteBackend = DeleteBackend::Relative;
+    // Read every file back after the last pass and compare it, a file that differs is kept (--verify)
+    bool verify = false;
+    // Overlapped writes in flight per file, 1 = one synchronous write at a time (--queue-depth=N)
+    unsigned int queueDepth = 8;
+    // Bytes per write, rounded to 64 KB (--block-size=N in KB)
+    size_t writeBlockSize = 1024 * 1024;
+    // Back the write buffers with large pages, needs the "Lock pages in memory" right (--large-pages)
+    bool largePages = false;
+    DurabilityMode durability = DurabilityMode::WriteThrough;
+    // Trim the clusters of every file after its overwrite, before it is deleted (--trim)
+    bool trim = false;
+    // Overwrite and verify throughput over all workers, 0 = unlimited (--max-rate=N in MB/s)
+    uint64_t maxBytesPerSecond = 0;
+    // Files and directories opened for deletion per second over all workers, 0 = unlimited (--max-ops=N)
+    uint64_t maxOpsPerSecond = 0;
+    // Give the writes of the shredder the lowest I/O priority, so other programs on the
+    // same disk go first (--background)
+    bool backgroundIo = false;
+    // Truncate, reset the timestamps and rename every entry to random names before it is
+    // deleted, so its name and dates do not survive in the directory (--scrub-names)
+    bool scrubNames = false;
+    // Fill the free space of the volumes of the targets instead of shredding them (--wipe-free)
+    bool wipeFreeSpace = false;
+};
@@ -0,0 +1,51 @@
+#include "StorageDevice.h"
+#include <vector>
+#include <algorithm>
+
+StorageDevice StorageDevice::ForPath(const wstring& path)
+{
+    StorageDevice device;
+    // The volume path can be longer than the input, e.g. for a relative one, but never
+    // longer than the full path
+    vector<wchar_t> volumePath(max(static_cast<DWORD>(MAX_PATH), GetFullPathName(path.c_str(), 0, nullptr, nullptr)) + 1);
+    wchar_t volumeName[MAX_PATH];
+    if (!GetVolumePathName(path.c_str(), volumePath.data(), static_cast<DWORD>(volumePath.size()))
+        || !GetVolumeNameForVolumeMountPoint(volumePath.data(), volumeName, MAX_PATH)) {
+        return device;
+    }
+
+    // "\\?\Volume{...}\" would open the root directory, without the backslash it is the volume.
+    // Both queries need no access rights, so this works without elevation.
+    wstring volume = volumeName;
+    if (!volume.empty() && volume.back() == L'\\') {
+        volume.pop_back();
+    }
+
+    HANDLE handle = CreateFile(volume.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return device;
+    }
+
+    // Spanned and striped volumes report several disks, the first one stands for all of them
+    union {
+        VOLUME_DISK_EXTENTS extents;
+        BYTE buffer[sizeof(VOLUME_DISK_EXTENTS) + 15 * sizeof(DISK_EXTENT)];
+    } diskExtents;
+    DWORD returned = 0;
+    if ((DeviceIoControl(handle, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS, nullptr, 0, &diskExtents, sizeof(diskExtents), &returned, nullptr) || GetLastError() == ERROR_MORE_DATA)
+        && diskExtents.extents.NumberOfDiskExtents > 0) {
+        device.diskNumber = diskExtents.extents.Extents[0].DiskNumber;
+    }
+
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageDeviceSeekPenaltyProperty;
+    query.QueryType = PropertyStandardQuery;
+    DEVICE_SEEK_PENALTY_DESCRIPTOR seekPenalty = {};
+    if (DeviceIoControl(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &seekPenalty, sizeof(seekPenalty), &returned, nullptr)
+        && returned >= sizeof(seekPenalty)) {
+        device.seekPenalty = seekPenalty.IncursSeekPenalty;
+    }
+
+    CloseHandle(handle);
+    return device;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+
+using namespace std;
+
+// The physical disk behind a path, so work on different disks can run side by side and a
+// spinning disk gets a single stream instead of seeking between many
+struct StorageDevice {
+    static constexpr DWORD unknownDisk = UINT32_MAX;
+
+    // N of \\.\PhysicalDriveN, unknownDisk for network shares and whatever cannot be asked
+    DWORD diskNumber = unknownDisk;
+    // Rotational disk
+    bool seekPenalty = false;
+
+    // Asks the volume of path, not the path itself, so it works for files and directories
+    static StorageDevice ForPath(const wstring& path);
+};